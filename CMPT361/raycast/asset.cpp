@@ -0,0 +1,117 @@
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+#include "asset.h"
+#include "simplify.h"
+#include "raycast.h"
+#include "pool.h"
+
+struct Asset {
+	std::promise<MeshRef> promise;
+	std::shared_future<MeshRef> mesh;
+	bool ready = false;
+	// model jobs waiting for the file to be read
+	std::vector<std::function<void()>> waiting;
+	// simplified_lods, made by a job of the first model that asks
+	std::vector<MeshData> lods;
+	std::atomic<bool> lods_started{false};
+	std::atomic<int> lods_unmade{1};
+};
+
+static std::mutex assets_mutex;
+static std::map<std::string, std::shared_ptr<Asset>> assets;
+// loads and models that haven't finished
+static std::atomic<int> pending(0);
+
+//
+// Finds the asset of the file, queueing the job that reads it the first
+// time it is asked for
+//
+static std::shared_ptr<Asset> find_asset(const std::string &filename) {
+	std::lock_guard<std::mutex> lock(assets_mutex);
+	std::shared_ptr<Asset> &asset = assets[filename];
+	if (asset) {
+		return asset;
+	}
+	asset = std::make_shared<Asset>();
+	asset->mesh = asset->promise.get_future().share();
+
+	pending++;
+	std::shared_ptr<Asset> a = asset;
+	render_pool().queue_job([a, filename] {
+		a->promise.set_value(std::make_shared<MeshData>(read_smf(filename)));
+		std::vector<std::function<void()>> waiting;
+		{
+			std::lock_guard<std::mutex> lock(assets_mutex);
+			a->ready = true;
+			waiting.swap(a->waiting);
+		}
+		for (auto &job : waiting) {
+			render_pool().queue_job(std::move(job));
+		}
+		pending--;
+	});
+	return asset;
+}
+
+std::shared_future<MeshRef> load_mesh(const std::string &filename) {
+	return find_asset(filename)->mesh;
+}
+
+std::shared_future<Model *> load_model(const std::string &filename, const Vector &off,
+		bool compact, std::function<void(Model *)> setup) {
+	std::shared_ptr<Asset> asset = find_asset(filename);
+	auto promise = std::make_shared<std::promise<Model *>>();
+	std::shared_future<Model *> model = promise->get_future().share();
+
+	// the job only runs once the file is read, so it never waits on a job
+	// that hasn't started
+	pending++;
+	auto job = [asset, filename, off, compact, setup, promise] {
+		Model *m = new Model(filename, *asset->mesh.get(), off, compact);
+		if (setup) {
+			setup(m);
+		}
+		if (!lazy_build_on) {
+			m->prepare();
+		}
+		promise->set_value(m);
+		pending--;
+	};
+
+	std::unique_lock<std::mutex> lock(assets_mutex);
+	if (asset->ready) {
+		lock.unlock();
+		render_pool().queue_job(job);
+	} else {
+		asset->waiting.push_back(job);
+	}
+	return model;
+}
+
+const std::vector<MeshData> &simplified_lods(const std::string &filename, int levels) {
+	std::shared_ptr<Asset> a = find_asset(filename);
+	if (!a->lods_started.exchange(true)) {
+		render_pool().queue_job([a, filename, levels] {
+			auto start = std::chrono::steady_clock::now();
+			a->lods = simplify_levels(*a->mesh.get(), levels, LOD_RATIO);
+			auto end = std::chrono::steady_clock::now();
+			printf("Simplified %s to", filename.c_str());
+			for (const MeshData &mesh : a->lods) {
+				printf(" %d", (int)mesh.faces.size());
+			}
+			printf(" faces in %.1f ms\n",
+				std::chrono::duration<float, std::milli>(end - start).count());
+			a->lods_unmade--;
+		});
+	}
+	render_pool().wait_jobs(a->lods_unmade);
+	return a->lods;
+}
+
+void wait_assets() {
+	render_pool().wait_jobs(pending);
+}
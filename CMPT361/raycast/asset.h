@@ -0,0 +1,33 @@
+#pragma once
+
+/**********************************************************************
+ * Loads meshes on the render threads while the scene is being set up.
+ * Each file is read once, and the models made from it are set up (moved,
+ * normals, bounds and BVH) by jobs of their own as soon as it is read.
+ **********************************************************************/
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include "model.h"
+
+typedef std::shared_ptr<const MeshData> MeshRef;
+
+// Starts reading the file unless it has been asked for before
+std::shared_future<MeshRef> load_mesh(const std::string &filename);
+
+// Starts making a model of the file moved by off. setup runs on the model
+// in the same job, before its BVH is built (the BVH is left for the first
+// ray with +z).
+std::shared_future<Model *> load_model(const std::string &filename, const Vector &off,
+	bool compact, std::function<void(Model *)> setup = nullptr);
+
+// The mesh of the file simplified to levels coarser levels of detail (see
+// simplify_levels), made once for all the models of the file. The first
+// call queues the job that makes them, and every call runs queued jobs
+// until they are made. levels must be the same for every call, and the
+// file must have been read, as it has in the setup of load_model.
+const std::vector<MeshData> &simplified_lods(const std::string &filename, int levels);
+
+// Helps with the loading jobs until everything asked for is loaded
+void wait_assets();
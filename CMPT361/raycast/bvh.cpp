@@ -0,0 +1,291 @@
+#include "bvh.h"
+#include "trace.h"
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+#define BINS 16
+#define MAX_LEAF 8
+// ranges at least this big are binned and partitioned in parallel
+#define PARALLEL_SIZE 65536
+#define CHUNK_SIZE 16384
+// subtrees at least this big are built as a separate job
+#define JOB_SIZE 2048
+
+struct Bounds {
+	Vector min;
+	Vector max;
+
+	Bounds() : min(1e30f), max(-1e30f) {}
+	void grow(const Vector &p) {
+		for (int a = 0; a < 3; ++a) {
+			min[a] = std::min(min[a], p[a]);
+			max[a] = std::max(max[a], p[a]);
+		}
+	}
+	void grow(const Bounds &b) {
+		grow(b.min);
+		grow(b.max);
+	}
+	float area() const {
+		Vector d = max - min;
+		if (d.x < 0) {
+			return 0;
+		}
+		return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+};
+
+struct Bin {
+	Bounds bounds;
+	int count;
+};
+
+//
+// Runs fn(c) for every chunk of [begin, end), spreading the chunks over
+// the render threads
+//
+static void parallel_chunks(int begin, int end, const std::function<void(int, int, int)> &fn) {
+	int chunks = (end - begin + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::atomic<int> pending(chunks - 1);
+	for (int c = 1; c < chunks; ++c) {
+		queue_job([&, c] {
+			fn(c, begin + c * CHUNK_SIZE, std::min(end, begin + (c + 1) * CHUNK_SIZE));
+			pending--;
+		});
+	}
+	fn(0, begin, std::min(end, begin + CHUNK_SIZE));
+	wait_jobs(pending);
+}
+
+struct Builder {
+	Builder(const std::vector<Vector> &bbmin, const std::vector<Vector> &bbmax,
+			std::vector<int> &order, std::vector<BVHNode> &nodes) :
+		bbmin(bbmin), bbmax(bbmax), order(order), nodes(nodes), used(1), pending(0) {}
+
+	void node(int n, int begin, int end, int depth);
+	void bounds(int begin, int end, Bounds &b, Bounds &cb);
+	void bin(int begin, int end, int axis, const Bounds &cb, Bin *bins);
+	int partition(int begin, int end, int axis, const Bounds &cb, int split);
+	int binOf(int prim, int axis, const Bounds &cb) const {
+		float extent = cb.max[axis] - cb.min[axis];
+		if (extent <= 0) {
+			return 0;
+		}
+		int b = (centroid[prim][axis] - cb.min[axis]) / extent * BINS;
+		return std::min(std::max(b, 0), BINS - 1);
+	}
+
+	const std::vector<Vector> &bbmin;
+	const std::vector<Vector> &bbmax;
+	std::vector<Vector> centroid;
+	std::vector<int> &order;
+	std::vector<int> scratch;
+	std::vector<BVHNode> &nodes;
+	std::atomic<int> used;
+	std::atomic<int> pending;
+};
+
+void Builder::bounds(int begin, int end, Bounds &b, Bounds &cb) {
+	if (end - begin < PARALLEL_SIZE) {
+		for (int i = begin; i < end; ++i) {
+			b.grow(bbmin[order[i]]);
+			b.grow(bbmax[order[i]]);
+			cb.grow(centroid[order[i]]);
+		}
+		return;
+	}
+	int chunks = (end - begin + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::vector<Bounds> bs(chunks), cbs(chunks);
+	parallel_chunks(begin, end, [&](int c, int s, int e) {
+		bounds(s, e, bs[c], cbs[c]);
+	});
+	for (int c = 0; c < chunks; ++c) {
+		b.grow(bs[c]);
+		cb.grow(cbs[c]);
+	}
+}
+
+void Builder::bin(int begin, int end, int axis, const Bounds &cb, Bin *bins) {
+	for (int k = 0; k < BINS; ++k) {
+		bins[k].count = 0;
+		bins[k].bounds = Bounds();
+	}
+	if (end - begin < PARALLEL_SIZE) {
+		for (int i = begin; i < end; ++i) {
+			Bin &bin = bins[binOf(order[i], axis, cb)];
+			bin.count++;
+			bin.bounds.grow(bbmin[order[i]]);
+			bin.bounds.grow(bbmax[order[i]]);
+		}
+		return;
+	}
+	int chunks = (end - begin + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::vector<Bin> local(chunks * BINS);
+	parallel_chunks(begin, end, [&](int c, int s, int e) {
+		bin(s, e, axis, cb, &local[c * BINS]);
+	});
+	for (int c = 0; c < chunks; ++c) {
+		for (int k = 0; k < BINS; ++k) {
+			bins[k].count += local[c * BINS + k].count;
+			bins[k].bounds.grow(local[c * BINS + k].bounds);
+		}
+	}
+}
+
+//
+// Moves the primitives in bins up to and including split to the front.
+// Big ranges count each chunk, then scatter the chunks into scratch.
+//
+int Builder::partition(int begin, int end, int axis, const Bounds &cb, int split) {
+	if (end - begin < PARALLEL_SIZE) {
+		return std::partition(order.begin() + begin, order.begin() + end,
+			[&](int p) { return binOf(p, axis, cb) <= split; }) - order.begin();
+	}
+
+	int chunks = (end - begin + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::vector<int> left(chunks);
+	parallel_chunks(begin, end, [&](int c, int s, int e) {
+		left[c] = 0;
+		for (int i = s; i < e; ++i) {
+			left[c] += binOf(order[i], axis, cb) <= split;
+		}
+	});
+
+	std::vector<int> loff(chunks), roff(chunks);
+	int total = 0;
+	for (int c = 0; c < chunks; ++c) {
+		loff[c] = begin + total;
+		total += left[c];
+	}
+	int mid = begin + total;
+	for (int c = 0; c < chunks; ++c) {
+		roff[c] = mid + (c * CHUNK_SIZE - (loff[c] - begin));
+	}
+
+	parallel_chunks(begin, end, [&](int c, int s, int e) {
+		int l = loff[c];
+		int r = roff[c];
+		for (int i = s; i < e; ++i) {
+			if (binOf(order[i], axis, cb) <= split) {
+				scratch[l++] = order[i];
+			} else {
+				scratch[r++] = order[i];
+			}
+		}
+	});
+	parallel_chunks(begin, end, [&](int c, int s, int e) {
+		std::copy(scratch.begin() + s, scratch.begin() + e, order.begin() + s);
+	});
+	return mid;
+}
+
+void Builder::node(int n, int begin, int end, int depth) {
+	Bounds b, cb;
+	bounds(begin, end, b, cb);
+	nodes[n].bbmin = b.min;
+	nodes[n].bbmax = b.max;
+	nodes[n].start = begin;
+	nodes[n].count = end - begin;
+	int count = end - begin;
+	if (count <= 2 || depth == BVH_MAX_DEPTH) {
+		return;
+	}
+
+	// binned surface area heuristic over all three axes
+	float best = 1e30f;
+	int bestAxis = -1;
+	int bestSplit = 0;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (cb.max[axis] <= cb.min[axis]) {
+			continue;
+		}
+		Bin bins[BINS];
+		bin(begin, end, axis, cb, bins);
+
+		float rightArea[BINS];
+		int rightCount[BINS];
+		Bounds rb;
+		int rc = 0;
+		for (int k = BINS - 1; k > 0; --k) {
+			rb.grow(bins[k].bounds);
+			rc += bins[k].count;
+			rightArea[k] = rb.area();
+			rightCount[k] = rc;
+		}
+		Bounds lb;
+		int lc = 0;
+		for (int k = 0; k < BINS - 1; ++k) {
+			lb.grow(bins[k].bounds);
+			lc += bins[k].count;
+			if (lc == 0 || rightCount[k + 1] == 0) {
+				continue;
+			}
+			float cost = lc * lb.area() + rightCount[k + 1] * rightArea[k + 1];
+			if (cost < best) {
+				best = cost;
+				bestAxis = axis;
+				bestSplit = k;
+			}
+		}
+	}
+
+	// compare to the cost of testing every primitive in a leaf
+	float leafCost = count * b.area();
+	float splitCost = b.area() + best;
+	if (count <= MAX_LEAF && leafCost <= splitCost) {
+		return;
+	}
+
+	int mid = -1;
+	if (bestAxis != -1) {
+		mid = partition(begin, end, bestAxis, cb, bestSplit);
+	}
+	if (mid <= begin || mid >= end) {
+		if (count <= MAX_LEAF) {
+			return;
+		}
+		// every centroid is in the same place
+		mid = (begin + end) / 2;
+	}
+
+	int left = used.fetch_add(2);
+	nodes[n].start = left;
+	nodes[n].count = 0;
+
+	if (mid - begin >= JOB_SIZE) {
+		pending++;
+		queue_job([this, left, begin, mid, depth] {
+			node(left, begin, mid, depth + 1);
+			pending--;
+		});
+	} else {
+		node(left, begin, mid, depth + 1);
+	}
+	node(left + 1, mid, end, depth + 1);
+}
+
+void BVH::build(const std::vector<Vector> &bbmin, const std::vector<Vector> &bbmax,
+		std::vector<int> &order) {
+	int size = bbmin.size();
+	order.resize(size);
+	nodes.clear();
+	if (size == 0) {
+		return;
+	}
+	// a binary tree with a primitive per leaf is the worst case
+	nodes.resize(2 * size - 1);
+
+	Builder b(bbmin, bbmax, order, nodes);
+	b.centroid.resize(size);
+	b.scratch.resize(size);
+	for (int i = 0; i < size; ++i) {
+		order[i] = i;
+		b.centroid[i] = (bbmin[i] + bbmax[i]) * 0.5;
+	}
+	b.node(0, 0, size, 0);
+	wait_jobs(b.pending);
+
+	nodes.resize(b.used);
+	nodes.shrink_to_fit();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+/**********************************************************************
+ * Bounding volume hierarchy over the faces of a model
+ **********************************************************************/
+#include <vector>
+#include "vector.h"
+
+// Deeper nodes are made leaves whatever their size, so a walk of the tree
+// never has more than BVH_MAX_DEPTH + 1 nodes waiting
+#define BVH_MAX_DEPTH 64
+
+struct BVHNode {
+	Vector bbmin;
+	Vector bbmax;
+	int start;	// first primitive of leaves, left child of inner nodes
+	int count;	// number of primitives, 0 for inner nodes
+};
+
+class BVH {
+public:
+	// Builds the tree over primitives with the given bounds. order is
+	// filled with the primitive order that the leaves index into.
+	void build(const std::vector<Vector> &bbmin, const std::vector<Vector> &bbmax,
+		std::vector<int> &order);
+	bool empty() const { return nodes.empty(); }
+
+	// the right child of an inner node directly follows the left
+	std::vector<BVHNode> nodes;
+};
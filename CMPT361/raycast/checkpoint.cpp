@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+
+#include "checkpoint.h"
+#include "deflate.h"
+#include "encode.h"
+#include "global.h"
+
+/*********************************************************************
+ * The file is
+ *
+ *   "RCKP", version, key, width, height, TILE_SIZE, tile count
+ *   the index of every tile in the file
+ *   a deflate stream of the tiles in that order
+ *   crc32 of everything before it
+ *
+ * with big endian 32 bit numbers. Each tile is its float RGB pixels,
+ * bottom row first, split into planes of the first, second, third and
+ * fourth bytes of the floats, which deflate compresses far better than
+ * the floats themselves.
+ *********************************************************************/
+#define CHECKPOINT_VERSION 1
+
+static void put_u32(std::vector<unsigned char> &out, uint32_t v) {
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+Checkpoint::Checkpoint(const std::string &name, uint32_t key, float *pixels, int width,
+		int height, int stride) :
+		_name(name), _key(key), _pixels(pixels), _width(width), _height(height),
+		_stride(stride), _stopping(false), _remove(false) {
+	int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	_done.assign(tiles_x * tiles_y, 0);
+	_thread = std::thread(&Checkpoint::writer, this);
+}
+
+Checkpoint::~Checkpoint() {
+	_mutex.lock();
+	_stopping = true;
+	_mutex.unlock();
+	_wake.notify_one();
+	_thread.join();
+}
+
+void Checkpoint::tileRect(int tile, int &x0, int &y0, int &x1, int &y1) const {
+	int tiles_x = (_width + TILE_SIZE - 1) / TILE_SIZE;
+	x0 = tile % tiles_x * TILE_SIZE;
+	y0 = tile / tiles_x * TILE_SIZE;
+	x1 = std::min(x0 + TILE_SIZE, _width);
+	y1 = std::min(y0 + TILE_SIZE, _height);
+}
+
+void Checkpoint::tileDone(int tile) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_ready.push_back(tile);
+}
+
+void Checkpoint::finish() {
+	_mutex.lock();
+	_stopping = true;
+	_remove = true;
+	_mutex.unlock();
+	_wake.notify_one();
+}
+
+//
+// Appends the tile to the stream, byte planes and all
+//
+void Checkpoint::compressTile(int tile) {
+	int x0, y0, x1, y1;
+	tileRect(tile, x0, y0, x1, y1);
+	int floats = (x1 - x0) * (y1 - y0) * 3;
+	std::vector<unsigned char> planes(floats * 4);
+	int n = 0;
+	for (int i = y0; i < y1; ++i) {
+		for (int j = x0; j < x1; ++j) {
+			for (int c = 0; c < 3; ++c, ++n) {
+				uint32_t v;
+				memcpy(&v, &_pixels[(i * _stride + j) * 3 + c], 4);
+				for (int b = 0; b < 4; ++b) {
+					planes[b * floats + n] = v >> (8 * b);
+				}
+			}
+		}
+	}
+	deflate(&planes[0], planes.size(), false, _stream);
+	_order.push_back(tile);
+}
+
+//
+// Writes the tiles so far next to the file and renames it over, so an
+// interrupted write leaves the last checkpoint as it was
+//
+bool Checkpoint::write() {
+	std::vector<unsigned char> out;
+	put_u32(out, 0x52434b50);	// "RCKP"
+	put_u32(out, CHECKPOINT_VERSION);
+	put_u32(out, _key);
+	put_u32(out, _width);
+	put_u32(out, _height);
+	put_u32(out, TILE_SIZE);
+	put_u32(out, _order.size());
+	for (int tile : _order) {
+		put_u32(out, tile);
+	}
+	out.insert(out.end(), _stream.begin(), _stream.end());
+	// the final block, which the stream of each tile leaves out
+	deflate(nullptr, 0, true, out);
+	put_u32(out, crc32(0, &out[0], out.size()));
+
+	std::string temp = _name + ".tmp";
+	if (!write_file(temp.c_str(), out) || rename(temp.c_str(), _name.c_str()) != 0) {
+		return false;
+	}
+	return true;
+}
+
+/*********************************************************************
+ * Wakes every CHECKPOINT_SECONDS, deflates the tiles that finished
+ * since the last time and writes the file. Tiles are only read once
+ * they are done, so the render threads never wait on a write. When it
+ * is stopped before the frame is done, e.g. by quitting, the tiles that
+ * are left are written one last time.
+ *********************************************************************/
+void Checkpoint::writer() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (;;) {
+		if (!_stopping) {
+			_wake.wait_for(lock, std::chrono::seconds(CHECKPOINT_SECONDS));
+		}
+		bool last = _stopping;
+		if (_remove) {
+			break;
+		}
+		if (_ready.empty()) {
+			if (last) {
+				break;
+			}
+			continue;
+		}
+		std::vector<int> ready;
+		ready.swap(_ready);
+		lock.unlock();
+
+		auto start = std::chrono::steady_clock::now();
+		for (int tile : ready) {
+			compressTile(tile);
+		}
+		if (write()) {
+			auto end = std::chrono::steady_clock::now();
+			printf("Checkpoint of %d of %d tiles, %d KB in %.1f ms\n", (int)_order.size(),
+				tiles(), (int)(_stream.size() / 1024),
+				std::chrono::duration<float, std::milli>(end - start).count());
+		}
+		lock.lock();
+		if (last) {
+			break;
+		}
+	}
+	if (_remove) {
+		remove(_name.c_str());
+	}
+}
+
+int Checkpoint::resume() {
+	std::vector<unsigned char> data;
+	FILE *fp = fopen(_name.c_str(), "rb");
+	if (!fp) {
+		return -1;
+	}
+	unsigned char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		data.insert(data.end(), buf, buf + n);
+	}
+	fclose(fp);
+
+	const size_t header = 28;
+	if (data.size() < header + 4 || memcmp(&data[0], "RCKP", 4) != 0 ||
+			get_u32(&data[data.size() - 4]) != crc32(0, &data[0], data.size() - 4)) {
+		printf("%s is not a checkpoint\n", _name.c_str());
+		return -1;
+	}
+	if (get_u32(&data[4]) != CHECKPOINT_VERSION || get_u32(&data[8]) != _key ||
+			(int)get_u32(&data[12]) != _width || (int)get_u32(&data[16]) != _height ||
+			get_u32(&data[20]) != TILE_SIZE) {
+		printf("%s is of another render\n", _name.c_str());
+		return -1;
+	}
+	uint32_t count = get_u32(&data[24]);
+	if (count > _done.size() || header + count * 4 + 4 > data.size()) {
+		printf("%s is not a checkpoint\n", _name.c_str());
+		return -1;
+	}
+
+	std::vector<unsigned char> planes;
+	size_t start = header + count * 4;
+	if (!inflate(&data[start], data.size() - 4 - start, planes)) {
+		printf("%s is broken\n", _name.c_str());
+		return -1;
+	}
+	// check the sizes of every tile before touching the pixels
+	size_t total = 0;
+	for (uint32_t k = 0; k < count; ++k) {
+		int tile = get_u32(&data[header + k * 4]);
+		if (tile < 0 || tile >= tiles()) {
+			printf("%s is broken\n", _name.c_str());
+			return -1;
+		}
+		int x0, y0, x1, y1;
+		tileRect(tile, x0, y0, x1, y1);
+		total += (x1 - x0) * (y1 - y0) * 3 * 4;
+	}
+	if (total != planes.size()) {
+		printf("%s is broken\n", _name.c_str());
+		return -1;
+	}
+
+	const unsigned char *p = planes.data();
+	std::vector<int> loaded;
+	for (uint32_t k = 0; k < count; ++k) {
+		int tile = get_u32(&data[header + k * 4]);
+		int x0, y0, x1, y1;
+		tileRect(tile, x0, y0, x1, y1);
+		int floats = (x1 - x0) * (y1 - y0) * 3;
+		int n = 0;
+		for (int i = y0; i < y1; ++i) {
+			for (int j = x0; j < x1; ++j) {
+				for (int c = 0; c < 3; ++c, ++n) {
+					uint32_t v = 0;
+					for (int b = 0; b < 4; ++b) {
+						v |= (uint32_t)p[b * floats + n] << (8 * b);
+					}
+					memcpy(&_pixels[(i * _stride + j) * 3 + c], &v, 4);
+				}
+			}
+		}
+		p += floats * 4;
+		_done[tile] = 1;
+		loaded.push_back(tile);
+	}
+	// they go in the next checkpoint along with the new ones
+	std::lock_guard<std::mutex> lock(_mutex);
+	_ready.insert(_ready.begin(), loaded.begin(), loaded.end());
+	return count;
+}
+
+uint32_t checkpoint_key(int argc, char **argv) {
+	uint32_t key = 0;
+	for (int i = 1; i < argc; ++i) {
+		// resuming, threads, saving, the preview passes, scheduling and
+		// the cost report don't change the image
+		if (strcmp(argv[i], "+u") == 0 || strncmp(argv[i], "+j", 2) == 0 ||
+				strcmp(argv[i], "+n") == 0 || strcmp(argv[i], "+i") == 0 ||
+				strcmp(argv[i], "+b") == 0 || strcmp(argv[i], "+k") == 0) {
+			continue;
+		}
+		key = crc32(key, (const unsigned char *)argv[i], strlen(argv[i]) + 1);
+	}
+	return key;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+/**********************************************************************
+ * Checkpoints of the frame while it renders, so that a long render that
+ * is stopped can carry on from the tiles it had finished (+u).
+ *
+ * The file holds the tiles that were done, deflated, and a key of the
+ * flags they were rendered with. It is written every CHECKPOINT_SECONDS
+ * by a thread of its own, so the render threads only add a tile to a
+ * list when they finish it, and it is removed once the frame is done.
+ **********************************************************************/
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+class Checkpoint {
+public:
+	// Checkpoints of the width by height pixels, with rows of stride
+	// floats, into the file name. Tiles are TILE_SIZE squares in the order
+	// of build_tiles.
+	Checkpoint(const std::string &name, uint32_t key, float *pixels, int width, int height,
+		int stride);
+	// Stops the writer, without removing the file
+	~Checkpoint();
+
+	// Loads the tiles of the file into the pixels. Returns how many there
+	// were, or -1 if there is no file or it is of another render.
+	int resume();
+	bool done(int tile) const { return _done[tile]; }
+	int tiles() const { return _done.size(); }
+
+	// Called by the render thread that finished the tile
+	void tileDone(int tile);
+	// The frame is complete: stops the writer and removes the file
+	void finish();
+
+private:
+	void writer();
+	void compressTile(int tile);
+	bool write();
+	void tileRect(int tile, int &x0, int &y0, int &x1, int &y1) const;
+
+	std::string _name;
+	uint32_t _key;
+	float *_pixels;
+	int _width;
+	int _height;
+	int _stride;
+	std::vector<char> _done;	// tiles loaded by resume
+
+	// tiles finished since the last write, and the writer state
+	std::vector<int> _ready;
+	bool _stopping;
+	bool _remove;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::thread _thread;
+
+	// only touched by the writer: the deflated tiles so far, in order
+	std::vector<int> _order;
+	std::vector<unsigned char> _stream;
+};
+
+// A key of the arguments that change the image, so that +u only resumes
+// a checkpoint of the same render
+uint32_t checkpoint_key(int argc, char **argv);
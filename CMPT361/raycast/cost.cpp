@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "cost.h"
+#include "raycast.h"
+#include "image_util.h"
+
+// Tiles listed by report_costs
+#define COST_REPORT_TILES 8
+
+thread_local RayCounters ray_counters;
+
+struct PixelCost {
+	float time;	// ns
+	uint32_t rays;
+	uint32_t shadow_rays;
+	uint32_t object_tests;
+	uint32_t face_tests;
+};
+
+static PixelCost pixel_cost[WIN_HEIGHT][WIN_WIDTH];
+static ImageBuffer heatmap;
+
+CostProbe start_cost() {
+	return {ray_counters, std::chrono::steady_clock::now()};
+}
+
+void record_cost(int i, int j, const CostProbe &probe) {
+	auto end = std::chrono::steady_clock::now();
+	const RayCounters &c = ray_counters;
+	PixelCost &p = pixel_cost[i][j];
+	p.time = std::chrono::duration<float, std::nano>(end - probe.start).count();
+	p.rays = c.rays - probe.counters.rays;
+	p.shadow_rays = c.shadow_rays - probe.counters.shadow_rays;
+	p.object_tests = c.object_tests - probe.counters.object_tests;
+	p.face_tests = c.face_tests - probe.counters.face_tests;
+}
+
+void reset_costs() {
+	memset(pixel_cost, 0, sizeof(pixel_cost));
+}
+
+struct TileCost {
+	int x;
+	int y;
+	int pixels;
+	double time;
+	double rays;
+	double shadow_rays;
+	double object_tests;
+	double face_tests;
+};
+
+static void add_cost(TileCost &t, const PixelCost &p) {
+	t.pixels++;
+	t.time += p.time;
+	t.rays += p.rays;
+	t.shadow_rays += p.shadow_rays;
+	t.object_tests += p.object_tests;
+	t.face_tests += p.face_tests;
+}
+
+/*********************************************************************
+ * Sums the pixel costs over the tiles and prints the frame totals, how
+ * much of the time the most expensive tenth of the tiles takes, and the
+ * most expensive tiles with their rays and tests per pixel. Tiles with
+ * many face tests are on meshes, ones with many rays per pixel are on
+ * reflective and refractive objects.
+ *********************************************************************/
+void report_costs() {
+	int tiles_x = (win_width + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (win_height + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<TileCost> tiles(tiles_x * tiles_y);
+	TileCost total = {0, 0, 0, 0, 0, 0, 0, 0};
+	for (int ty = 0; ty < tiles_y; ++ty) {
+		for (int tx = 0; tx < tiles_x; ++tx) {
+			TileCost &t = tiles[ty * tiles_x + tx];
+			t = {tx * TILE_SIZE, ty * TILE_SIZE, 0, 0, 0, 0, 0, 0};
+			for (int i = t.y; i < std::min(t.y + TILE_SIZE, win_height); ++i) {
+				for (int j = t.x; j < std::min(t.x + TILE_SIZE, win_width); ++j) {
+					add_cost(t, pixel_cost[i][j]);
+					add_cost(total, pixel_cost[i][j]);
+				}
+			}
+		}
+	}
+	if (total.time <= 0) {
+		return;
+	}
+
+	std::sort(tiles.begin(), tiles.end(), [](const TileCost &a, const TileCost &b) {
+		return a.time > b.time;
+	});
+	double top = 0;
+	int tenth = std::max(1, (int)tiles.size() / 10);
+	for (int k = 0; k < tenth; ++k) {
+		top += tiles[k].time;
+	}
+
+	printf("Cost: %.1f ms traced, %.0f rays, %.0f shadow rays, %.0f object tests, %.0f face tests\n",
+		total.time / 1e6, total.rays, total.shadow_rays, total.object_tests, total.face_tests);
+	printf("The most expensive %d of %d tiles take %.1f%% of the time\n", tenth,
+		(int)tiles.size(), 100 * top / total.time);
+	printf("  tile (x, y)      ms      %%   rays/px  shadow/px  objects/px  faces/px\n");
+	for (int k = 0; k < std::min(COST_REPORT_TILES, (int)tiles.size()); ++k) {
+		const TileCost &t = tiles[k];
+		double n = std::max(1, t.pixels);
+		printf("  (%3d, %3d)  %7.2f  %5.1f  %8.1f  %9.1f  %10.1f  %8.1f\n", t.x, t.y,
+			t.time / 1e6, 100 * t.time / total.time, t.rays / n, t.shadow_rays / n,
+			t.object_tests / n, t.face_tests / n);
+	}
+}
+
+//
+// Blue through cyan, green and yellow to red for v in [0, 1]
+//
+static void false_colour(float v, float *out) {
+	static const float ramp[5][3] = {
+		{0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0},
+	};
+	v = std::min(std::max(v, 0.0f), 1.0f) * 4;
+	int k = std::min((int)v, 3);
+	float f = v - k;
+	for (int c = 0; c < 3; ++c) {
+		out[c] = ramp[k][c] * (1 - f) + ramp[k + 1][c] * f;
+	}
+}
+
+/*********************************************************************
+ * The time of each pixel relative to the 99th percentile, so a few very
+ * slow pixels don't push the rest into blue
+ *********************************************************************/
+void save_heatmap() {
+	std::vector<float> times;
+	times.reserve(win_width * win_height);
+	for (int i = 0; i < win_height; ++i) {
+		for (int j = 0; j < win_width; ++j) {
+			times.push_back(pixel_cost[i][j].time);
+		}
+	}
+	auto p99 = times.begin() + times.size() * 99 / 100;
+	std::nth_element(times.begin(), p99, times.end());
+	float scale = *p99 > 0 ? 1 / *p99 : 0;
+	for (int i = 0; i < win_height; ++i) {
+		for (int j = 0; j < win_width; ++j) {
+			false_colour(pixel_cost[i][j].time * scale, heatmap[i][j]);
+		}
+	}
+
+	std::string name = add_to_name(output_name, "_cost");
+	PostSettings linear = {false, 1, false, 1};
+	save_image(name.c_str(), heatmap, linear);
+}
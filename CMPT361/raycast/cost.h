@@ -0,0 +1,36 @@
+#pragma once
+
+/**********************************************************************
+ * Render cost per pixel and per tile for +k. The counters are kept by
+ * every render thread, only by the kernels compiled with TRACE_COSTS,
+ * and rayThread takes the difference over each pixel.
+ **********************************************************************/
+#include <chrono>
+#include <cstdint>
+
+struct RayCounters {
+	uint64_t rays;	// primary and secondary rays
+	uint64_t shadow_rays;
+	uint64_t object_tests;	// calls to Object::intersect
+	uint64_t face_tests;	// triangles tested by models
+};
+
+extern thread_local RayCounters ray_counters;
+
+// The counters and clock at the start of a pixel
+struct CostProbe {
+	RayCounters counters;
+	std::chrono::steady_clock::time_point start;
+};
+
+CostProbe start_cost();
+// Stores the cost of pixel (i, j) since probe was started
+void record_cost(int i, int j, const CostProbe &probe);
+
+// Clears the costs of the last frame
+void reset_costs();
+// Prints the totals and the most expensive TILE_SIZE tiles
+void report_costs();
+// Saves the time of every pixel as a false colour image next to
+// output_name, with _cost added to the name
+void save_heatmap();
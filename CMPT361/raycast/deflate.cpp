@@ -0,0 +1,393 @@
+#include <algorithm>
+
+#include "deflate.h"
+
+// How many earlier positions with the same hash a match search looks at
+#define DEFLATE_CHAIN 32
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 15
+
+/////////////////////////////////////////////////////////////////////
+// Checksums
+
+uint32_t crc32(uint32_t crc, const unsigned char *data, size_t len) {
+	static uint32_t table[256];
+	static bool ready = false;
+	if (!ready) {
+		for (uint32_t n = 0; n < 256; ++n) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k) {
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			}
+			table[n] = c;
+		}
+		ready = true;
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < len; ++i) {
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+#define ADLER_BASE 65521
+
+uint32_t adler32(uint32_t adler, const unsigned char *data, size_t len) {
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+	while (len > 0) {
+		// the largest run that can't overflow b
+		size_t n = std::min(len, (size_t)5552);
+		for (size_t i = 0; i < n; ++i) {
+			a += data[i];
+			b += a;
+		}
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+		data += n;
+		len -= n;
+	}
+	return a | (b << 16);
+}
+
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+	uint32_t rem = len2 % ADLER_BASE;
+	uint32_t sum1 = adler1 & 0xffff;
+	uint32_t sum2 = (rem * sum1) % ADLER_BASE;
+	sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+	sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+	if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+	if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+	if (sum2 >= ADLER_BASE * 2) sum2 -= ADLER_BASE * 2;
+	if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+	return sum1 | (sum2 << 16);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Deflate with LZ77 and the fixed Huffman codes
+
+static const int length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const int dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Packs bits starting from the least significant, like deflate wants
+class BitWriter {
+public:
+	BitWriter(std::vector<unsigned char> &out) : _out(out), _bits(0), _count(0) {}
+
+	void put(uint32_t bits, int n) {
+		_bits |= (uint64_t)bits << _count;
+		_count += n;
+		while (_count >= 8) {
+			_out.push_back(_bits & 0xff);
+			_bits >>= 8;
+			_count -= 8;
+		}
+	}
+
+	// Huffman codes are stored from the most significant bit
+	void putCode(uint32_t code, int n) {
+		uint32_t r = 0;
+		for (int i = 0; i < n; ++i) {
+			r = (r << 1) | ((code >> i) & 1);
+		}
+		put(r, n);
+	}
+
+	void align() {
+		if (_count > 0) {
+			put(0, 8 - _count);
+		}
+	}
+private:
+	std::vector<unsigned char> &_out;
+	uint64_t _bits;
+	int _count;
+};
+
+static void put_literal(BitWriter &bits, int v) {
+	if (v < 144) {
+		bits.putCode(0x30 + v, 8);
+	} else if (v < 256) {
+		bits.putCode(0x190 + v - 144, 9);
+	} else if (v < 280) {
+		bits.putCode(v - 256, 7);
+	} else {
+		bits.putCode(0xc0 + v - 280, 8);
+	}
+}
+
+static void put_match(BitWriter &bits, int length, int dist) {
+	int l = std::upper_bound(length_base, length_base + 29, length) - length_base - 1;
+	put_literal(bits, 257 + l);
+	bits.put(length - length_base[l], length_extra[l]);
+	int d = std::upper_bound(dist_base, dist_base + 30, dist) - dist_base - 1;
+	bits.putCode(d, 5);
+	bits.put(dist - dist_base[d], dist_extra[d]);
+}
+
+static inline uint32_t hash3(const unsigned char *p) {
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/*********************************************************************
+ * Compresses data as one block with the fixed Huffman codes. Matches are
+ * found greedily through hash chains over the last DEFLATE_WINDOW bytes.
+ *********************************************************************/
+void deflate(const unsigned char *data, size_t len, bool last, std::vector<unsigned char> &out) {
+	BitWriter bits(out);
+	bits.put(last ? 1 : 0, 1);
+	bits.put(1, 2);
+
+	std::vector<int> head(1 << DEFLATE_HASH_BITS, -1);
+	std::vector<int> prev(len);
+	size_t i = 0;
+	while (i < len) {
+		int best = 0;
+		int best_dist = 0;
+		if (i + 3 <= len) {
+			uint32_t h = hash3(data + i);
+			int max = std::min(len - i, (size_t)258);
+			int chain = DEFLATE_CHAIN;
+			for (int p = head[h]; p != -1 && i - p <= DEFLATE_WINDOW && chain-- > 0; p = prev[p]) {
+				if (data[p + best] != data[i + best]) {
+					continue;
+				}
+				int n = 0;
+				while (n < max && data[p + n] == data[i + n]) {
+					++n;
+				}
+				if (n > best) {
+					best = n;
+					best_dist = i - p;
+					if (n == max) {
+						break;
+					}
+				}
+			}
+			prev[i] = head[h];
+			head[h] = i;
+		}
+
+		if (best >= 3) {
+			put_match(bits, best, best_dist);
+			// the skipped positions still go in the chains
+			for (size_t k = i + 1; k < i + best && k + 3 <= len; ++k) {
+				uint32_t h = hash3(data + k);
+				prev[k] = head[h];
+				head[h] = k;
+			}
+			i += best;
+		} else {
+			put_literal(bits, data[i]);
+			++i;
+		}
+	}
+	put_literal(bits, 256);
+
+	if (!last) {
+		// sync flush: an empty stored block ends on a byte boundary
+		bits.put(0, 3);
+		bits.align();
+		out.push_back(0x00);
+		out.push_back(0x00);
+		out.push_back(0xff);
+		out.push_back(0xff);
+	} else {
+		bits.align();
+	}
+}
+
+/////////////////////////////////////////////////////////////////////
+// Inflate, enough for any valid stream
+
+// Reads bits starting from the least significant
+struct BitReader {
+	const unsigned char *data;
+	size_t len;
+	size_t pos;
+	uint32_t buf;
+	int count;
+	bool error;
+
+	int bits(int n) {
+		while (count < n) {
+			if (pos >= len) {
+				error = true;
+				return 0;
+			}
+			buf |= (uint32_t)data[pos++] << count;
+			count += 8;
+		}
+		int v = buf & ((1u << n) - 1);
+		buf >>= n;
+		count -= n;
+		return v;
+	}
+};
+
+// Canonical Huffman code: how many codes there are of each length and the
+// symbols in code order
+struct Huffman {
+	short count[16];
+	short symbol[288];
+};
+
+static void build_huffman(Huffman &h, const short *lengths, int n) {
+	std::fill(h.count, h.count + 16, 0);
+	for (int i = 0; i < n; ++i) {
+		h.count[lengths[i]]++;
+	}
+	h.count[0] = 0;
+	short offset[16];
+	offset[1] = 0;
+	for (int len = 1; len < 15; ++len) {
+		offset[len + 1] = offset[len] + h.count[len];
+	}
+	for (int i = 0; i < n; ++i) {
+		if (lengths[i] != 0) {
+			h.symbol[offset[lengths[i]]++] = i;
+		}
+	}
+}
+
+static int decode_symbol(BitReader &in, const Huffman &h) {
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (int len = 1; len < 16; ++len) {
+		code |= in.bits(1);
+		int count = h.count[len];
+		if (code - count < first) {
+			return h.symbol[index + (code - first)];
+		}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	in.error = true;
+	return -1;
+}
+
+static bool inflate_codes(BitReader &in, const Huffman &lit, const Huffman &dist,
+		std::vector<unsigned char> &out) {
+	while (!in.error) {
+		int symbol = decode_symbol(in, lit);
+		if (symbol < 0 || symbol > 285) {
+			return false;
+		} else if (symbol < 256) {
+			out.push_back(symbol);
+		} else if (symbol == 256) {
+			return true;
+		} else {
+			symbol -= 257;
+			int length = length_base[symbol] + in.bits(length_extra[symbol]);
+			int d = decode_symbol(in, dist);
+			if (d < 0 || d > 29) {
+				return false;
+			}
+			size_t back = dist_base[d] + in.bits(dist_extra[d]);
+			if (back > out.size()) {
+				return false;
+			}
+			size_t from = out.size() - back;
+			for (int k = 0; k < length; ++k) {
+				out.push_back(out[from + k]);
+			}
+		}
+	}
+	return false;
+}
+
+bool inflate(const unsigned char *data, size_t len, std::vector<unsigned char> &out) {
+	static const int order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+	BitReader in = {data, len, 0, 0, 0, false};
+	bool last = false;
+	while (!last) {
+		last = in.bits(1);
+		int type = in.bits(2);
+		if (in.error) {
+			return false;
+		}
+		if (type == 0) {
+			// stored, starts on a byte boundary
+			in.buf = 0;
+			in.count = 0;
+			if (in.pos + 4 > len) {
+				return false;
+			}
+			size_t n = data[in.pos] | data[in.pos + 1] << 8;
+			size_t check = data[in.pos + 2] | data[in.pos + 3] << 8;
+			in.pos += 4;
+			if (n != (~check & 0xffff) || in.pos + n > len) {
+				return false;
+			}
+			out.insert(out.end(), data + in.pos, data + in.pos + n);
+			in.pos += n;
+			continue;
+		}
+
+		Huffman lit, dist;
+		short lengths[320];
+		if (type == 1) {
+			for (int i = 0; i < 288; ++i) {
+				lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+			}
+			build_huffman(lit, lengths, 288);
+			std::fill(lengths, lengths + 30, 5);
+			build_huffman(dist, lengths, 30);
+		} else if (type == 2) {
+			int nlit = in.bits(5) + 257;
+			int ndist = in.bits(5) + 1;
+			int ncode = in.bits(4) + 4;
+			std::fill(lengths, lengths + 19, 0);
+			for (int i = 0; i < ncode; ++i) {
+				lengths[order[i]] = in.bits(3);
+			}
+			Huffman code;
+			build_huffman(code, lengths, 19);
+
+			int i = 0;
+			while (i < nlit + ndist && !in.error) {
+				int symbol = decode_symbol(in, code);
+				int repeat = 0;
+				short value = 0;
+				if (symbol < 0) {
+					return false;
+				} else if (symbol < 16) {
+					lengths[i++] = symbol;
+					continue;
+				} else if (symbol == 16) {
+					if (i == 0) {
+						return false;
+					}
+					value = lengths[i - 1];
+					repeat = 3 + in.bits(2);
+				} else if (symbol == 17) {
+					repeat = 3 + in.bits(3);
+				} else {
+					repeat = 11 + in.bits(7);
+				}
+				if (i + repeat > nlit + ndist) {
+					return false;
+				}
+				while (repeat-- > 0) {
+					lengths[i++] = value;
+				}
+			}
+			build_huffman(lit, lengths, nlit);
+			build_huffman(dist, lengths + nlit, ndist);
+		} else {
+			return false;
+		}
+		if (!inflate_codes(in, lit, dist, out)) {
+			return false;
+		}
+	}
+	return !in.error;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+/**********************************************************************
+ * zlib checksums and a small deflate/inflate. Doesn't depend on the rest
+ * of the ray tracer, so tools can link it on its own.
+ **********************************************************************/
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+uint32_t crc32(uint32_t crc, const unsigned char *data, size_t len);
+uint32_t adler32(uint32_t adler, const unsigned char *data, size_t len);
+// The adler32 of two pieces joined, from the adler32 of each and the
+// length of the second
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2);
+// Appends a raw deflate stream of data to out. Unless last, the stream
+// ends in a sync flush (an empty stored block), so streams of pieces of
+// the data can be joined into one.
+void deflate(const unsigned char *data, size_t len, bool last, std::vector<unsigned char> &out);
+// Appends the data of a raw deflate stream to out. False if the stream is
+// broken.
+bool inflate(const unsigned char *data, size_t len, std::vector<unsigned char> &out);
@@ -0,0 +1,169 @@
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "denoise.h"
+#include "raycast.h"
+#include "pool.h"
+
+// Guide buffers, one plane per value so rows can be walked with plain
+// loops that the compiler vectorizes
+float aov_normal[3][WIN_HEIGHT][WIN_WIDTH];
+float aov_depth[WIN_HEIGHT][WIN_WIDTH];
+// index into scene, -1 for the background
+int aov_object[WIN_HEIGHT][WIN_WIDTH];
+float aov_noise[3][WIN_HEIGHT][WIN_WIDTH];
+
+// The noise being filtered and the output of the current pass
+float denoise_color[2][3][WIN_HEIGHT][WIN_WIDTH];
+
+void set_aov(int i, int j, int object, const Vector &norm, float depth) {
+	aov_normal[0][i][j] = norm.x;
+	aov_normal[1][i][j] = norm.y;
+	aov_normal[2][i][j] = norm.z;
+	aov_depth[i][j] = depth;
+	aov_object[i][j] = object;
+}
+
+void set_noise(int i, int j, const RGB_float &noise) {
+	aov_noise[0][i][j] = noise.r;
+	aov_noise[1][i][j] = noise.g;
+	aov_noise[2][i][j] = noise.b;
+}
+
+// B3 spline, the usual a-trous kernel
+static const float kernel[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+
+// The guides and noise of one row, shifted by dx pixels
+struct Row {
+	const float *nx, *ny, *nz;
+	const float *z;
+	const int *id;
+	const float *r, *g, *b;
+};
+
+static Row get_row(const float (*in)[WIN_HEIGHT][WIN_WIDTH], int y, int dx) {
+	Row row;
+	row.nx = aov_normal[0][y] + dx;
+	row.ny = aov_normal[1][y] + dx;
+	row.nz = aov_normal[2][y] + dx;
+	row.z = aov_depth[y] + dx;
+	row.id = aov_object[y] + dx;
+	row.r = in[0][y] + dx;
+	row.g = in[1][y] + dx;
+	row.b = in[2][y] + dx;
+	return row;
+}
+
+//
+// Adds the tap of weight h from row t to pixels [x0, x1) of row c. The
+// edge stopping functions avoid exp and pow, and the selects rely on
+// -fno-trapping-math, so this loop vectorizes.
+//
+static void add_tap(const Row &c, const Row &t, int x0, int x1, float h, float inv_sigma,
+		float depth_scale, float *__restrict sum_r, float *__restrict sum_g,
+		float *__restrict sum_b, float *__restrict sum_w) {
+	for (int x = x0; x < x1; ++x) {
+		// normals: max(0, cos)^64
+		float wn = c.nx[x] * t.nx[x] + c.ny[x] * t.ny[x] + c.nz[x] * t.nz[x];
+		wn = wn > 0 ? wn : 0;
+		wn *= wn; wn *= wn; wn *= wn;
+		wn *= wn; wn *= wn; wn *= wn;
+		// depth, relative to the distance of the pixel
+		float wz = 1 - std::fabs(c.z[x] - t.z[x]) / (depth_scale * c.z[x] + 1e-6f);
+		wz = wz > 0 ? wz : 0;
+		// colour
+		float dr = c.r[x] - t.r[x];
+		float dg = c.g[x] - t.g[x];
+		float db = c.b[x] - t.b[x];
+		float wc = 1 / (1 + (dr * dr + dg * dg + db * db) * inv_sigma);
+		float w = c.id[x] == t.id[x] ? h * wn * wz * wc : 0;
+
+		sum_r[x] += w * t.r[x];
+		sum_g[x] += w * t.g[x];
+		sum_b[x] += w * t.b[x];
+		sum_w[x] += w;
+	}
+}
+
+//
+// One pass of the filter over rows [y0, y1) with taps step pixels apart
+//
+static void filter_rows(int y0, int y1, int step, float sigma,
+		const float (*in)[WIN_HEIGHT][WIN_WIDTH], float (*out)[WIN_HEIGHT][WIN_WIDTH]) {
+	std::vector<float> acc(win_width * 4);
+	float *sum_r = &acc[0];
+	float *sum_g = &acc[win_width];
+	float *sum_b = &acc[win_width * 2];
+	float *sum_w = &acc[win_width * 3];
+	float inv_sigma = 1 / (sigma * sigma);
+	float depth_scale = DENOISE_DEPTH * step;
+
+	for (int y = y0; y < y1; ++y) {
+		std::fill(acc.begin(), acc.end(), 0);
+		Row c = get_row(in, y, 0);
+		for (int ky = 0; ky < 5; ++ky) {
+			int yy = y + (ky - 2) * step;
+			if (yy < 0 || yy >= win_height) {
+				continue;
+			}
+			for (int kx = 0; kx < 5; ++kx) {
+				int dx = (kx - 2) * step;
+				add_tap(c, get_row(in, yy, dx), std::max(0, -dx), std::min(win_width, win_width - dx),
+					kernel[ky] * kernel[kx], inv_sigma, depth_scale, sum_r, sum_g, sum_b, sum_w);
+			}
+		}
+
+		// the centre tap always has weight, so sum_w isn't 0
+		for (int x = 0; x < win_width; ++x) {
+			out[0][y][x] = sum_r[x] / sum_w[x];
+			out[1][y][x] = sum_g[x] / sum_w[x];
+			out[2][y][x] = sum_b[x] / sum_w[x];
+		}
+	}
+}
+
+/*********************************************************************
+ * Runs DENOISE_PASSES passes of the a-trous filter over the stochastic
+ * diffuse part of the frame, the taps twice as far apart each pass.
+ * Pixels are only mixed with pixels of the same object whose normal and
+ * depth are close, and the colour weight gets stricter every pass so
+ * edges in the lighting survive.
+ * Background pixels only mix with each other.
+ *********************************************************************/
+void denoise_frame() {
+	auto start = std::chrono::steady_clock::now();
+	std::copy(&aov_noise[0][0][0], &aov_noise[0][0][0] + 3 * WIN_HEIGHT * WIN_WIDTH,
+		&denoise_color[0][0][0][0]);
+
+	RenderPool &pool = render_pool();
+	int count = pool.size();
+	int cur = 0;
+	float sigma = DENOISE_COLOR;
+	for (int pass = 0; pass < DENOISE_PASSES; ++pass) {
+		int step = 1 << pass;
+		const float (*in)[WIN_HEIGHT][WIN_WIDTH] = denoise_color[cur];
+		float (*out)[WIN_HEIGHT][WIN_WIDTH] = denoise_color[1 - cur];
+		pool.parallel_for(count, [=](int k) {
+			filter_rows(win_height * k / count, win_height * (k + 1) / count, step, sigma, in, out);
+		});
+		cur = 1 - cur;
+		sigma *= 0.5;
+	}
+
+	frame_mutex.lock();
+	for (int y = 0; y < win_height; ++y) {
+		for (int x = 0; x < win_width; ++x) {
+			for (int c = 0; c < 3; ++c) {
+				frame[y][x][c] += denoise_color[cur][c][y][x] - aov_noise[c][y][x];
+			}
+		}
+	}
+	frame_mutex.unlock();
+
+	auto end = std::chrono::steady_clock::now();
+	printf("Denoised in %d ms\n",
+		(int)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+/**********************************************************************
+ * Edge-aware a-trous filter for noisy frames, guided by the normal,
+ * depth and object of the first hit of every pixel
+ **********************************************************************/
+#include "global.h"
+#include "vector.h"
+
+// Saves the guide values of pixel (i, j). object is the index into scene,
+// -1 for the background.
+void set_aov(int i, int j, int object, const Vector &norm, float depth);
+
+// Saves the part of the colour of pixel (i, j) that is noisy. Only this
+// part is filtered, so textures and direct lighting stay sharp.
+void set_noise(int i, int j, const RGB_float &noise);
+
+// Filters the noisy part of the frame buffer in place
+void denoise_frame();
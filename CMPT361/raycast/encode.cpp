@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "encode.h"
+#include "deflate.h"
+#include "raycast.h"
+#include "postprocess.h"
+#include "pool.h"
+
+// Rows of a png compressed by one job. Matches can't reach back into the
+// rows of another job, so this trades a little size for threads.
+#define PNG_CHUNK_ROWS 32
+
+bool write_file(const char *fname, const std::vector<unsigned char> &data) {
+	FILE *fp = fopen(fname, "wb");
+	if (!fp) {
+		printf("Unable to open file '%s'\n", fname);
+		return false;
+	}
+	fwrite(&data[0], 1, data.size(), fp);
+	fclose(fp);
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////
+// PNG
+
+static void put_u32(std::vector<unsigned char> &out, uint32_t v) {
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+static void put_chunk(std::vector<unsigned char> &out, const char *type,
+		const unsigned char *data, size_t len) {
+	put_u32(out, len);
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data, data + len);
+	put_u32(out, crc32(0, &out[start], len + 4));
+}
+
+static inline int paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+//
+// Filters one row of 3 byte pixels into out, which starts with the filter
+// type. Tries every filter and keeps the one with the smallest sum of
+// absolute differences.
+//
+static void filter_row(const unsigned char *row, const unsigned char *up, int n, unsigned char *out) {
+	std::vector<unsigned char> trial(n);
+	long best_cost = -1;
+	for (int f = 0; f < 5; ++f) {
+		long cost = 0;
+		for (int x = 0; x < n; ++x) {
+			int a = x >= 3 ? row[x - 3] : 0;
+			int b = up != nullptr ? up[x] : 0;
+			int c = x >= 3 && up != nullptr ? up[x - 3] : 0;
+			int pred = 0;
+			switch (f) {
+			case 1: pred = a; break;
+			case 2: pred = b; break;
+			case 3: pred = (a + b) / 2; break;
+			case 4: pred = paeth(a, b, c); break;
+			}
+			trial[x] = row[x] - pred;
+			cost += abs((signed char)trial[x]);
+		}
+		if (best_cost == -1 || cost < best_cost) {
+			best_cost = cost;
+			out[0] = f;
+			std::copy(trial.begin(), trial.end(), out + 1);
+		}
+	}
+}
+
+/*********************************************************************
+ * Saves the developed frame as a PNG. Rows are filtered in parallel, then
+ * every PNG_CHUNK_ROWS rows are deflated by a job of their own. The
+ * pieces end in sync flushes so they join into one zlib stream, and the
+ * adler32 of the whole stream is combined from theirs.
+ *********************************************************************/
+bool save_png(const char *fname, const ImageBuffer &image, const PostSettings &settings) {
+	int w = win_width;
+	int h = win_height;
+	int n = w * 3;
+	std::vector<unsigned char> pixels(n * h);
+	develop_frame(settings, &pixels[0], n, false, true, image);
+
+	std::vector<unsigned char> filtered((n + 1) * h);
+	RenderPool &pool = render_pool();
+	pool.parallel_for(h, [&](int y) {
+		filter_row(&pixels[y * n], y > 0 ? &pixels[(y - 1) * n] : nullptr, n, &filtered[y * (n + 1)]);
+	});
+
+	int chunks = (h + PNG_CHUNK_ROWS - 1) / PNG_CHUNK_ROWS;
+	std::vector<std::vector<unsigned char>> pieces(chunks);
+	std::vector<uint32_t> sums(chunks);
+	pool.parallel_for(chunks, [&](int k) {
+		size_t start = (size_t)k * PNG_CHUNK_ROWS * (n + 1);
+		size_t end = std::min((size_t)(k + 1) * PNG_CHUNK_ROWS, (size_t)h) * (n + 1);
+		deflate(&filtered[start], end - start, k == chunks - 1, pieces[k]);
+		sums[k] = adler32(1, &filtered[start], end - start);
+	});
+
+	std::vector<unsigned char> zlib;
+	// deflate with a 32K window, no dictionary, fastest level
+	zlib.push_back(0x78);
+	zlib.push_back(0x01);
+	uint32_t adler = 1;
+	for (int k = 0; k < chunks; ++k) {
+		zlib.insert(zlib.end(), pieces[k].begin(), pieces[k].end());
+		size_t rows = std::min(PNG_CHUNK_ROWS, h - k * PNG_CHUNK_ROWS);
+		adler = adler32_combine(adler, sums[k], rows * (n + 1));
+	}
+	put_u32(zlib, adler);
+
+	std::vector<unsigned char> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	std::vector<unsigned char> ihdr;
+	put_u32(ihdr, w);
+	put_u32(ihdr, h);
+	// 8 bits per channel, RGB, deflate, adaptive filters, no interlacing
+	unsigned char format[5] = {8, 2, 0, 0, 0};
+	ihdr.insert(ihdr.end(), format, format + 5);
+	put_chunk(file, "IHDR", &ihdr[0], ihdr.size());
+	put_chunk(file, "IDAT", &zlib[0], zlib.size());
+	put_chunk(file, "IEND", nullptr, 0);
+
+	printf("Saving image %s: %d x %d\n", fname, w, h);
+	return write_file(fname, file);
+}
+
+/////////////////////////////////////////////////////////////////////
+// PPM and PFM
+
+bool save_ppm(const char *fname, const ImageBuffer &image, const PostSettings &settings) {
+	int w = win_width;
+	int h = win_height;
+	char header[64];
+	int len = sprintf(header, "P6\n%d %d\n255\n", w, h);
+	std::vector<unsigned char> file(len + w * h * 3);
+	memcpy(&file[0], header, len);
+	develop_frame(settings, &file[len], w * 3, false, true, image);
+
+	printf("Saving image %s: %d x %d\n", fname, w, h);
+	return write_file(fname, file);
+}
+
+//
+// The frame as it was traced, little endian floats with the bottom row
+// first like the frame itself
+//
+bool save_pfm(const char *fname, const ImageBuffer &image) {
+	int w = win_width;
+	int h = win_height;
+	char header[64];
+	int len = sprintf(header, "PF\n%d %d\n-1.0\n", w, h);
+	std::vector<unsigned char> file(len + w * h * 3 * sizeof(float));
+	memcpy(&file[0], header, len);
+	for (int y = 0; y < h; ++y) {
+		memcpy(&file[len + y * w * 3 * sizeof(float)], image[y], w * 3 * sizeof(float));
+	}
+
+	printf("Saving image %s: %d x %d\n", fname, w, h);
+	return write_file(fname, file);
+}
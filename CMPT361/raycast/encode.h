@@ -0,0 +1,20 @@
+#pragma once
+
+/**********************************************************************
+ * Image file encoders for the frame. save_image (image_util.cpp) picks
+ * one from the extension of the output name.
+ **********************************************************************/
+#include <vector>
+#include "postprocess.h"
+
+// 8-bit RGB PNG, deflated in parallel by our own compressor
+bool save_png(const char *fname, const ImageBuffer &image = frame,
+	const PostSettings &settings = post_settings);
+// 8-bit binary PPM (P6)
+bool save_ppm(const char *fname, const ImageBuffer &image = frame,
+	const PostSettings &settings = post_settings);
+// Float PFM of the frame before the post process
+bool save_pfm(const char *fname, const ImageBuffer &image = frame);
+
+// Writes the whole buffer to fname, printing an error on failure
+bool write_file(const char *fname, const std::vector<unsigned char> &data);
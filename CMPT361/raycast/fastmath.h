@@ -0,0 +1,50 @@
+#pragma once
+
+/**********************************************************************
+ * Approximations of pow and 1 / sqrt for the fast math mode (+m). pow
+ * multiplies out small integer exponents, which every shininess is, and
+ * leaves the rest to powf. 1 / sqrt starts from the hardware estimate
+ * (about 12 bits on SSE and 8 on NEON) and refines it with Newton steps.
+ **********************************************************************/
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "include/vec.h"
+
+// x to the y, by squaring for integer y in [0, 64)
+inline float fast_pow(float x, float y) {
+	int n = (int)y;
+	if (n != y || n < 0 || n >= 64) {
+		return powf(x, y);
+	}
+	float r = 1;
+	for (; n != 0; n >>= 1, x *= x) {
+		if (n & 1) {
+			r *= x;
+		}
+	}
+	return r;
+}
+
+inline float fast_rsqrt(float x) {
+	float y;
+#if defined(ANGEL_SSE)
+	y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+	y = y * (1.5f - 0.5f * x * y * y);
+#elif defined(ANGEL_NEON)
+	float32x2_t v = vdup_n_f32(x);
+	float32x2_t e = vrsqrte_f32(v);
+	e = vmul_f32(e, vrsqrts_f32(vmul_f32(v, e), e));
+	e = vmul_f32(e, vrsqrts_f32(vmul_f32(v, e), e));
+	y = vget_lane_f32(e, 0);
+#else
+	// the bit trick is only good to 3.4e-2, so it takes two steps
+	uint32_t i;
+	memcpy(&i, &x, sizeof(i));
+	i = 0x5f375a86 - (i >> 1);
+	memcpy(&y, &i, sizeof(y));
+	y = y * (1.5f - 0.5f * x * y * y);
+	y = y * (1.5f - 0.5f * x * y * y);
+#endif
+	return y;
+}
@@ -3,5 +3,27 @@
 #define WIN_WIDTH 512
 #define WIN_HEIGHT 512
 #define STOCH_RAYS 5
+#define LIGHT_SAMPLES 8
+#define TILE_SIZE 16
+// pixels per side of the blocks in the first +i preview pass
+#define PREVIEW_BLOCK 4
+// +d filter passes, and how far apart the depths and colours of two
+// pixels can be before they stop being mixed
+#define DENOISE_PASSES 3
+#define DENOISE_DEPTH 0.05
+#define DENOISE_COLOR 0.25
+// area lights get a grid of AREA_PROBES by AREA_PROBES shadow rays, and
+// AREA_SAMPLES by AREA_SAMPLES more where some of those are blocked
+#define AREA_PROBES 2
+#define AREA_SAMPLES 4
+// seconds between checkpoints of the frame
+#define CHECKPOINT_SECONDS 30
+// pixels of each tile the +b pre-pass traces to estimate its cost
+#define SCHEDULE_SAMPLES 4
+// A coarser mesh level is used once its faces are smaller than the ray
+// cone times this
+#define LOD_SCALE 1.0f
+// +a<n> levels of detail, each with this fraction of the faces of the last
+#define LOD_RATIO 0.25f
 
 #define IMAGE_WIDTH 5.0
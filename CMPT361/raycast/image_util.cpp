@@ -1,39 +1,32 @@
 #include <stdio.h>
 #include <GL/glut.h>
 #include <string.h>
+#include <strings.h>
+#include <vector>
 #include "global.h"
 #include "raycast.h"
+#include "postprocess.h"
+#include "pool.h"
+#include "encode.h"
+#include "cost.h"
 
 /*********************************************************
- * This function saves the current image to a ppm file
+ * Saves the current image to a bmp file
  *
- * DO NOT CHANGE
+ * The pixels are developed by the post process straight into
+ * the file buffer, which is kept between saves.
  *********************************************************/
-void save_image() {
+static bool save_bmp(const char *fname, const ImageBuffer &image, const PostSettings &settings) {
 	int w = win_width;
 	int h = win_height;
+	int stride = (w * 3 + 3) & ~3;
+	int filesize = 54 + stride * h;
 
-	unsigned char * bImg = new unsigned char[w * h * 3];
-
-	int index = 0;
-	for(int y = 0; y < h; y++) {
-		for(int x = 0; x < w; x++) {
-
-			float r = frame[y][x][0];
-			float g = frame[y][x][1];
-			float b = frame[y][x][2];
-
-			bImg[index] = (b > 1.f) ? 255 : (unsigned char)(b*255); index++;
-			bImg[index] = (g > 1.f) ? 255 : (unsigned char)(g*255); index++;
-			bImg[index] = (r > 1.f) ? 255 : (unsigned char)(r*255); index++;
-		}
-	}
+	static std::vector<unsigned char> file;
+	file.assign(filesize, 0);
 
 	unsigned char bmpfileheader[14] = {'B','M', 0,0,0,0, 0,0, 0,0, 54,0,0,0};
 	unsigned char bmpinfoheader[40] = {40,0,0,0, 0,0,0,0, 0,0,0,0, 1,0, 24,0};
-	unsigned char bmppad[3] = {0,0,0};
-
-	int filesize = 54 + 3*w*h;
 
 	bmpfileheader[ 2] = (unsigned char)(filesize);
 	bmpfileheader[ 3] = (unsigned char)(filesize>> 8);
@@ -49,55 +42,71 @@ void save_image() {
 	bmpinfoheader[10] = (unsigned char)(h>>16);
 	bmpinfoheader[11] = (unsigned char)(h>>24);
 
+	memcpy(&file[0], bmpfileheader, 14);
+	memcpy(&file[14], bmpinfoheader, 40);
+	// bmp rows go bottom up, like the frame
+	develop_frame(settings, &file[54], stride, true, false, image);
 
-	FILE *fp;
-	char fname[32];
-
-	strcpy(fname, "scene.bmp");
 	printf("Saving image %s: %d x %d\n", fname, w, h);
-	fp = fopen(fname, "wb");
-	if (!fp) {
-		printf("Unable to open file '%s'\n",fname);
-		return;
-	}
-
-
-	fwrite(bmpfileheader, 1, 14, fp);
-	fwrite(bmpinfoheader, 1, 40, fp);
+	return write_file(fname, file);
+}
 
-	for(int y = h-1; y >= 0; y--) {
-		int offset = w * (h - 1 - y) * 3;
-		fwrite(bImg + offset, 3, w, fp);
-		fwrite(bmppad, 1, (4 - (w * 3) % 4) % 4, fp);
+/*********************************************************
+ * Saves image to fname in the format given by its
+ * extension: .bmp, .png, .ppm or .pfm. Anything else is
+ * saved as a bmp.
+ *********************************************************/
+void save_image(const char *fname, const ImageBuffer &image, const PostSettings &settings) {
+	const char *ext = strrchr(fname, '.');
+	if (ext != nullptr && strcasecmp(ext, ".png") == 0) {
+		save_png(fname, image, settings);
+	} else if (ext != nullptr && strcasecmp(ext, ".ppm") == 0) {
+		save_ppm(fname, image, settings);
+	} else if (ext != nullptr && strcasecmp(ext, ".pfm") == 0) {
+		save_pfm(fname, image);
+	} else {
+		save_bmp(fname, image, settings);
 	}
+}
 
+//
+// Inserts suffix before the extension of fname
+//
+std::string add_to_name(const std::string &fname, const std::string &suffix) {
+	std::string name = fname;
+	size_t dot = name.rfind('.');
+	if (dot == std::string::npos || name.find('/', dot) != std::string::npos) {
+		dot = name.size();
+	}
+	return name.insert(dot, suffix);
+}
 
-	fclose(fp);
+/*********************************************************
+ * This function saves the current image to output_name.
+ * With heatmap_on the cost heatmap is saved next to it.
+ *********************************************************/
+void save_image() {
+	save_image(output_name, frame, post_settings);
+	if (heatmap_on) {
+		save_heatmap();
+	}
 }
 
 /**************************************************************
  * This function normalizes the frame resulting from ray
  * tracing so that the maximum R, G, or B value is 1.0
- *
- * DO NOT CHANGE
  **************************************************************/
 void histogram_normalization() {
-	GLfloat max_val = 0.0;
-	int i, j;
-
-	for (i=0; i<win_height; i++) {
-		for (j=0; j<win_width; j++) {
-			if (frame[i][j][0] > max_val) max_val = frame[i][j][0];
-			if (frame[i][j][1] > max_val) max_val = frame[i][j][1];
-			if (frame[i][j][2] > max_val) max_val = frame[i][j][2];
-		}
+	float max_val = frame_max();
+	if (max_val <= 0) {
+		return;
 	}
-
-	for (i=0; i<win_height; i++) {
-		for (j=0; j<win_width; j++) {
-			frame[i][j][0] /= max_val;
-			frame[i][j][1] /= max_val;
-			frame[i][j][2] /= max_val;
+	int bands = render_pool().size();
+	render_pool().parallel_for(bands, [=](int k) {
+		float *p = &frame[0][0][0];
+		int n = WIN_HEIGHT * WIN_WIDTH * 3;
+		for (int i = n * k / bands; i < n * (k + 1) / bands; ++i) {
+			p[i] /= max_val;
 		}
-	}
+	});
 }
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <string>
+#include "postprocess.h"
+
 // see the corresponding C++ file to see what they do
 void save_image();
+void save_image(const char *fname, const ImageBuffer &image, const PostSettings &settings);
+std::string add_to_name(const std::string &fname, const std::string &suffix);
 void histogram_normalization();
@@ -0,0 +1,243 @@
+/**********************************************************************
+ * Compares two images, for checking renders against golden images like
+ * default.png and mine.png.
+ *
+ *   ./imgcmp a.png b.bmp [tolerance]
+ *
+ * Reads 8-bit PNG (RGB or RGBA), 24-bit BMP and binary PPM. Prints how
+ * many pixels differ, the largest and mean channel difference and the
+ * PSNR. Exits with 0 when no channel differs by more than tolerance
+ * (default 0), 1 when one does and 2 when an image can't be read.
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "deflate.h"
+
+struct Image {
+	int width;
+	int height;
+	std::vector<unsigned char> rgb;	// top row first
+};
+
+static bool read_file(const char *fname, std::vector<unsigned char> &data) {
+	FILE *fp = fopen(fname, "rb");
+	if (!fp) {
+		printf("Unable to open file '%s'\n", fname);
+		return false;
+	}
+	unsigned char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		data.insert(data.end(), buf, buf + n);
+	}
+	fclose(fp);
+	return true;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+static bool load_png(const std::vector<unsigned char> &data, Image &img) {
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	if (data.size() < 8 || memcmp(&data[0], signature, 8) != 0) {
+		return false;
+	}
+	std::vector<unsigned char> zlib;
+	int channels = 0;
+	size_t pos = 8;
+	while (pos + 12 <= data.size()) {
+		uint32_t len = get_u32(&data[pos]);
+		if (pos + 12 + len > data.size()) {
+			return false;
+		}
+		const unsigned char *type = &data[pos + 4];
+		const unsigned char *body = &data[pos + 8];
+		if (crc32(0, type, len + 4) != get_u32(body + len)) {
+			printf("Bad CRC in %.4s chunk\n", type);
+			return false;
+		}
+		if (memcmp(type, "IHDR", 4) == 0) {
+			img.width = get_u32(body);
+			img.height = get_u32(body + 4);
+			int depth = body[8];
+			int color = body[9];
+			int interlace = body[12];
+			channels = color == 2 ? 3 : color == 6 ? 4 : 0;
+			if (depth != 8 || channels == 0 || interlace != 0) {
+				printf("Only 8-bit RGB and RGBA PNGs without interlacing are supported\n");
+				return false;
+			}
+		} else if (memcmp(type, "IDAT", 4) == 0) {
+			zlib.insert(zlib.end(), body, body + len);
+		}
+		pos += 12 + len;
+	}
+	if (channels == 0 || zlib.size() < 6) {
+		return false;
+	}
+
+	// skip the two byte zlib header, the adler32 is at the end
+	std::vector<unsigned char> raw;
+	if (!inflate(&zlib[2], zlib.size() - 6, raw)) {
+		printf("Broken deflate stream\n");
+		return false;
+	}
+	if (adler32(1, raw.empty() ? nullptr : &raw[0], raw.size()) != get_u32(&zlib[zlib.size() - 4])) {
+		printf("Bad adler32\n");
+		return false;
+	}
+	size_t n = (size_t)img.width * channels;
+	if (raw.size() < (n + 1) * img.height) {
+		return false;
+	}
+
+	std::vector<unsigned char> row(n), up(n, 0);
+	img.rgb.resize((size_t)img.width * img.height * 3);
+	for (int y = 0; y < img.height; ++y) {
+		const unsigned char *in = &raw[y * (n + 1)];
+		int filter = in[0];
+		for (size_t x = 0; x < n; ++x) {
+			int a = x >= (size_t)channels ? row[x - channels] : 0;
+			int b = up[x];
+			int c = x >= (size_t)channels ? up[x - channels] : 0;
+			int pred = 0;
+			switch (filter) {
+			case 1: pred = a; break;
+			case 2: pred = b; break;
+			case 3: pred = (a + b) / 2; break;
+			case 4: pred = paeth(a, b, c); break;
+			}
+			row[x] = in[x + 1] + pred;
+		}
+		for (int x = 0; x < img.width; ++x) {
+			for (int k = 0; k < 3; ++k) {
+				img.rgb[(y * img.width + x) * 3 + k] = row[x * channels + k];
+			}
+		}
+		up.swap(row);
+	}
+	return true;
+}
+
+static bool load_bmp(const std::vector<unsigned char> &data, Image &img) {
+	if (data.size() < 54 || data[0] != 'B' || data[1] != 'M' || data[28] != 24) {
+		return false;
+	}
+	uint32_t offset = data[10] | data[11] << 8 | data[12] << 16 | data[13] << 24;
+	img.width = data[18] | data[19] << 8 | data[20] << 16 | data[21] << 24;
+	img.height = data[22] | data[23] << 8 | data[24] << 16 | data[25] << 24;
+	size_t stride = (img.width * 3 + 3) & ~3;
+	if (offset + stride * img.height > data.size()) {
+		return false;
+	}
+	img.rgb.resize((size_t)img.width * img.height * 3);
+	for (int y = 0; y < img.height; ++y) {
+		// bottom row first, blue first
+		const unsigned char *in = &data[offset + (img.height - 1 - y) * stride];
+		for (int x = 0; x < img.width; ++x) {
+			for (int k = 0; k < 3; ++k) {
+				img.rgb[(y * img.width + x) * 3 + k] = in[x * 3 + 2 - k];
+			}
+		}
+	}
+	return true;
+}
+
+static bool load_ppm(const std::vector<unsigned char> &data, Image &img) {
+	std::string text(data.begin(), data.begin() + std::min(data.size(), (size_t)64));
+	int max = 0;
+	int used = 0;
+	if (sscanf(text.c_str(), "P6 %d %d %d%n", &img.width, &img.height, &max, &used) != 3 || max != 255) {
+		return false;
+	}
+	// a single whitespace character ends the header
+	size_t start = used + 1;
+	size_t size = (size_t)img.width * img.height * 3;
+	if (start + size > data.size()) {
+		return false;
+	}
+	img.rgb.assign(data.begin() + start, data.begin() + start + size);
+	return true;
+}
+
+static bool load_image(const char *fname, Image &img) {
+	std::vector<unsigned char> data;
+	if (!read_file(fname, data)) {
+		return false;
+	}
+	const char *ext = strrchr(fname, '.');
+	bool ok = false;
+	if (ext != nullptr && strcasecmp(ext, ".png") == 0) {
+		ok = load_png(data, img);
+	} else if (ext != nullptr && strcasecmp(ext, ".ppm") == 0) {
+		ok = load_ppm(data, img);
+	} else {
+		ok = load_bmp(data, img);
+	}
+	if (!ok) {
+		printf("Unable to read image '%s'\n", fname);
+	}
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		printf("Missing arguments ... use:\n");
+		printf("./imgcmp image1 image2 [tolerance]\n");
+		return 2;
+	}
+	int tolerance = argc > 3 ? atoi(argv[3]) : 0;
+
+	Image a, b;
+	if (!load_image(argv[1], a) || !load_image(argv[2], b)) {
+		return 2;
+	}
+	if (a.width != b.width || a.height != b.height) {
+		printf("Sizes differ: %d x %d and %d x %d\n", a.width, a.height, b.width, b.height);
+		return 1;
+	}
+
+	int max_diff = 0;
+	long pixels = 0;
+	double sum = 0;
+	double squares = 0;
+	for (size_t p = 0; p < a.rgb.size(); p += 3) {
+		bool differs = false;
+		for (int k = 0; k < 3; ++k) {
+			int d = abs(a.rgb[p + k] - b.rgb[p + k]);
+			max_diff = std::max(max_diff, d);
+			sum += d;
+			squares += d * d;
+			differs = differs || d > 0;
+		}
+		pixels += differs;
+	}
+	double mse = squares / a.rgb.size();
+	printf("%ld of %d pixels differ, max %d, mean %.4f, ", pixels, a.width * a.height,
+		max_diff, sum / a.rgb.size());
+	if (mse == 0) {
+		printf("identical\n");
+	} else {
+		printf("PSNR %.2f dB\n", 10 * log10(255.0 * 255.0 / mse));
+	}
+	return max_diff > tolerance ? 1 : 0;
+}
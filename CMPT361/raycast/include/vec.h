@@ -10,8 +10,104 @@
 #include <iostream>
 #include <cmath>
 
+// SSE on x86 and NEON on ARM, unless ANGEL_NO_SIMD asks for plain floats
+#if !defined(ANGEL_NO_SIMD) && (defined(__SSE__) || defined(_M_X64))
+#define ANGEL_SSE
+#include <xmmintrin.h>
+#elif !defined(ANGEL_NO_SIMD) && defined(__ARM_NEON)
+#define ANGEL_NEON
+#include <arm_neon.h>
+#endif
+
 struct vec4;
 
+//////////////////////////////////////////////////////////////////////////////
+//
+//  simd4 - four floats in a register, used by the vec4 and mat4 operators
+//
+//  Sums add the lanes in the same order as the scalar code would, so the
+//  results are the same bit for bit with or without SIMD.
+//
+
+#if defined(ANGEL_SSE)
+
+typedef __m128 simd4;
+
+inline simd4 simd_load( const float* p ) { return _mm_loadu_ps( p ); }
+inline void simd_store( float* p, simd4 a ) { _mm_storeu_ps( p, a ); }
+inline simd4 simd_splat( float s ) { return _mm_set1_ps( s ); }
+inline simd4 simd_add( simd4 a, simd4 b ) { return _mm_add_ps( a, b ); }
+inline simd4 simd_sub( simd4 a, simd4 b ) { return _mm_sub_ps( a, b ); }
+inline simd4 simd_mul( simd4 a, simd4 b ) { return _mm_mul_ps( a, b ); }
+inline simd4 simd_neg( simd4 a ) { return _mm_xor_ps( a, _mm_set1_ps( -0.0f ) ); }
+
+// (y, z, x) and (z, x, y) for cross products, w is left undefined
+inline simd4 simd_yzx( simd4 a ) { return _mm_shuffle_ps( a, a, _MM_SHUFFLE(3, 0, 2, 1) ); }
+inline simd4 simd_zxy( simd4 a ) { return _mm_shuffle_ps( a, a, _MM_SHUFFLE(3, 1, 0, 2) ); }
+
+inline void simd_transpose( simd4& r0, simd4& r1, simd4& r2, simd4& r3 )
+    { _MM_TRANSPOSE4_PS( r0, r1, r2, r3 ); }
+
+#elif defined(ANGEL_NEON)
+
+typedef float32x4_t simd4;
+
+inline simd4 simd_load( const float* p ) { return vld1q_f32( p ); }
+inline void simd_store( float* p, simd4 a ) { vst1q_f32( p, a ); }
+inline simd4 simd_splat( float s ) { return vdupq_n_f32( s ); }
+inline simd4 simd_add( simd4 a, simd4 b ) { return vaddq_f32( a, b ); }
+inline simd4 simd_sub( simd4 a, simd4 b ) { return vsubq_f32( a, b ); }
+inline simd4 simd_mul( simd4 a, simd4 b ) { return vmulq_f32( a, b ); }
+inline simd4 simd_neg( simd4 a ) { return vnegq_f32( a ); }
+
+// (y, z, x) and (z, x, y) for cross products, w is left undefined
+inline simd4 simd_yzx( simd4 a )
+    { return vsetq_lane_f32( vgetq_lane_f32( a, 0 ), vextq_f32( a, a, 1 ), 2 ); }
+inline simd4 simd_zxy( simd4 a ) { return simd_yzx( simd_yzx( a ) ); }
+
+inline void simd_transpose( simd4& r0, simd4& r1, simd4& r2, simd4& r3 ) {
+    float32x4x2_t t01 = vtrnq_f32( r0, r1 );
+    float32x4x2_t t23 = vtrnq_f32( r2, r3 );
+    r0 = vcombine_f32( vget_low_f32( t01.val[0] ), vget_low_f32( t23.val[0] ) );
+    r1 = vcombine_f32( vget_low_f32( t01.val[1] ), vget_low_f32( t23.val[1] ) );
+    r2 = vcombine_f32( vget_high_f32( t01.val[0] ), vget_high_f32( t23.val[0] ) );
+    r3 = vcombine_f32( vget_high_f32( t01.val[1] ), vget_high_f32( t23.val[1] ) );
+}
+
+#else
+
+struct simd4 { float v[4]; };
+
+inline simd4 simd_load( const float* p ) { return simd4{ { p[0], p[1], p[2], p[3] } }; }
+inline void simd_store( float* p, simd4 a )
+    { p[0] = a.v[0];  p[1] = a.v[1];  p[2] = a.v[2];  p[3] = a.v[3]; }
+inline simd4 simd_splat( float s ) { return simd4{ { s, s, s, s } }; }
+inline simd4 simd_add( simd4 a, simd4 b ) {
+    return simd4{ { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } };
+}
+inline simd4 simd_sub( simd4 a, simd4 b ) {
+    return simd4{ { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } };
+}
+inline simd4 simd_mul( simd4 a, simd4 b ) {
+    return simd4{ { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } };
+}
+inline simd4 simd_neg( simd4 a ) { return simd4{ { -a.v[0], -a.v[1], -a.v[2], -a.v[3] } }; }
+
+// (y, z, x) and (z, x, y) for cross products
+inline simd4 simd_yzx( simd4 a ) { return simd4{ { a.v[1], a.v[2], a.v[0], a.v[3] } }; }
+inline simd4 simd_zxy( simd4 a ) { return simd4{ { a.v[2], a.v[0], a.v[1], a.v[3] } }; }
+
+inline void simd_transpose( simd4& r0, simd4& r1, simd4& r2, simd4& r3 ) {
+    simd4 c0 = { { r0.v[0], r1.v[0], r2.v[0], r3.v[0] } };
+    simd4 c1 = { { r0.v[1], r1.v[1], r2.v[1], r3.v[1] } };
+    simd4 c2 = { { r0.v[2], r1.v[2], r2.v[2], r3.v[2] } };
+    simd4 c3 = { { r0.v[3], r1.v[3], r2.v[3], r3.v[3] } };
+    r0 = c0;  r1 = c1;  r2 = c2;  r3 = c3;
+}
+
+#endif
+
+
 //////////////////////////////////////////////////////////////////////////////
 //
 //  vec2.h - 2D vector
@@ -305,7 +401,7 @@ vec3 cross(const vec3& a, const vec3& b )
 //
 //////////////////////////////////////////////////////////////////////////////
 
-struct vec4 {
+struct alignas(16) vec4 {
 
     float  x;
     float  y;
@@ -322,7 +418,7 @@ struct vec4 {
     vec4( float x, float y, float z, float w ) :
 	x(x), y(y), z(z), w(w) {}
 
-    vec4( const vec4& v ) { x = v.x;  y = v.y;  z = v.z;  w = v.w; }
+    vec4( const vec4& v ) { simd_store( &x, v.simd() ); }
 
     vec4( const vec3& v, const float w = 1.0 ) : w(w)
 	{ x = v.x;  y = v.y;  z = v.z; }
@@ -330,6 +426,8 @@ struct vec4 {
     vec4( const vec2& v, const float z, const float w ) : z(z), w(w)
 	{ x = v.x;  y = v.y; }
 
+    explicit vec4( simd4 v ) { simd_store( &x, v ); }
+
     //
     //  --- Indexing Operator ---
     //
@@ -337,24 +435,30 @@ struct vec4 {
     float& operator [] ( int i ) { return *(&x + i); }
     const float operator [] ( int i ) const { return *(&x + i); }
 
+    //
+    //  --- SIMD Access ---
+    //
+
+    simd4 simd() const { return simd_load( &x ); }
+
     //
     //  --- (non-modifying) Arithematic Operators ---
     //
 
     vec4 operator - () const  // unary minus operator
-	{ return vec4( -x, -y, -z, -w ); }
+	{ return vec4( simd_neg( simd() ) ); }
 
     vec4 operator + ( const vec4& v ) const
-	{ return vec4( x + v.x, y + v.y, z + v.z, w + v.w ); }
+	{ return vec4( simd_add( simd(), v.simd() ) ); }
 
     vec4 operator - ( const vec4& v ) const
-	{ return vec4( x - v.x, y - v.y, z - v.z, w - v.w ); }
+	{ return vec4( simd_sub( simd(), v.simd() ) ); }
 
     vec4 operator * ( const float s ) const
-	{ return vec4( s*x, s*y, s*z, s*w ); }
+	{ return vec4( simd_mul( simd_splat( s ), simd() ) ); }
 
     vec4 operator * ( const vec4& v ) const
-	{ return vec4( x*v.x, y*v.y, z*v.z, w*v.z ); }
+	{ return vec4( simd_mul( simd(), v.simd() ) ); }
 
     friend vec4 operator * ( const float s, const vec4& v )
 	{ return v * s; }
@@ -377,16 +481,16 @@ struct vec4 {
     //
 
     vec4& operator += ( const vec4& v )
-	{ x += v.x;  y += v.y;  z += v.z;  w += v.w;  return *this; }
+	{ simd_store( &x, simd_add( simd(), v.simd() ) );  return *this; }
 
     vec4& operator -= ( const vec4& v )
-	{ x -= v.x;  y -= v.y;  z -= v.z;  w -= v.w;  return *this; }
+	{ simd_store( &x, simd_sub( simd(), v.simd() ) );  return *this; }
 
     vec4& operator *= ( const float s )
-	{ x *= s;  y *= s;  z *= s;  w *= s;  return *this; }
+	{ simd_store( &x, simd_mul( simd_splat( s ), simd() ) );  return *this; }
 
     vec4& operator *= ( const vec4& v )
-	{ x *= v.x, y *= v.y, z *= v.z, w *= v.w;  return *this; }
+	{ simd_store( &x, simd_mul( simd(), v.simd() ) );  return *this; }
 
     vec4& operator /= ( const float s ) {
 #ifdef DEBUG
@@ -434,7 +538,7 @@ inline void vec3::operator =( const vec4& v ) { x = v.x;  y = v.y;  z = v.z; }
 
 inline
 float dot( const vec4& u, const vec4& v ) {
-    return u.x*v.x + u.y*v.y + u.z*v.z + u.w+v.w;
+    return u.x*v.x + u.y*v.y + u.z*v.z + u.w*v.w;
 }
 
 inline
@@ -450,9 +554,11 @@ vec4 normalize( const vec4& v ) {
 inline
 vec3 cross(const vec4& a, const vec4& b )
 {
-    return vec3( a.y * b.z - a.z * b.y,
-		 a.z * b.x - a.x * b.z,
-		 a.x * b.y - a.y * b.x );
+    simd4 c = simd_sub( simd_mul( simd_yzx( a.simd() ), simd_zxy( b.simd() ) ),
+			simd_mul( simd_zxy( a.simd() ), simd_yzx( b.simd() ) ) );
+    alignas(16) float r[4];
+    simd_store( r, c );
+    return vec3( r[0], r[1], r[2] );
 }
 
 
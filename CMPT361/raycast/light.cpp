@@ -0,0 +1,175 @@
+#include "light.h"
+#include "render.h"
+#include <algorithm>
+#include <math.h>
+
+static float light_power(const Light &l) {
+	float p = 0;
+	for (int i = 0; i < 3; ++i) {
+		p += l.diffuse[i] + l.specular[i];
+	}
+	return p;
+}
+
+Point light_point(const Light &light, const Point &q, float u, float v) {
+	Vector offset;
+	if (light.shape == LIGHT_RECT) {
+		offset = light.edge_u * (u - 0.5f) + light.edge_v * (v - 0.5f);
+	} else if (light.shape == LIGHT_SPHERE) {
+		Vector w = normalize(get_vec(light.pos, q));
+		// any two directions across w
+		Vector a = fabs(w.x) > 0.5f ? Vector(0, 1, 0) : Vector(1, 0, 0);
+		a = normalize(cross(w, a));
+		Vector b = cross(w, a);
+		float r = light.radius * sqrtf(u);
+		float phi = 2 * M_PI * v;
+		offset = a * (r * cosf(phi)) + b * (r * sinf(phi));
+	}
+	return get_point(light.pos, offset);
+}
+
+// Corners of the box around the light
+static void light_bounds(const Light &l, Vector &lo, Vector &hi) {
+	Vector p = {l.pos.x, l.pos.y, l.pos.z};
+	Vector half;
+	if (l.shape == LIGHT_RECT) {
+		for (int a = 0; a < 3; ++a) {
+			half[a] = 0.5f * (fabs(l.edge_u[a]) + fabs(l.edge_v[a]));
+		}
+	} else if (l.shape == LIGHT_SPHERE) {
+		half = Vector(l.radius, l.radius, l.radius);
+	}
+	lo = p - half;
+	hi = p + half;
+}
+
+static float coord(const Point &p, int axis) {
+	return axis == 0 ? p.x : axis == 1 ? p.y : p.z;
+}
+
+static int build_node(Scene &scene, std::vector<int> &idx, int begin, int end) {
+	const std::vector<Light> &lights = scene.lights;
+	std::vector<LightNode> &light_tree = scene.light_tree;
+	LightNode node;
+	node.power = 0;
+	node.left = -1;
+	node.right = -1;
+	node.light = -1;
+	for (int i = begin; i < end; ++i) {
+		const Light &l = lights[idx[i]];
+		Vector lo, hi;
+		light_bounds(l, lo, hi);
+		for (int a = 0; a < 3; ++a) {
+			if (i == begin || lo[a] < node.bbmin[a]) {
+				node.bbmin[a] = lo[a];
+			}
+			if (i == begin || hi[a] > node.bbmax[a]) {
+				node.bbmax[a] = hi[a];
+			}
+		}
+		node.power += light_power(l);
+	}
+
+	int n = light_tree.size();
+	light_tree.push_back(node);
+	if (end - begin == 1) {
+		light_tree[n].light = idx[begin];
+		return n;
+	}
+
+	// split at the median of the longest axis
+	Vector extent = node.bbmax - node.bbmin;
+	int axis = 0;
+	if (extent.y > extent[axis]) {
+		axis = 1;
+	}
+	if (extent.z > extent[axis]) {
+		axis = 2;
+	}
+	int mid = (begin + end) / 2;
+	std::nth_element(idx.begin() + begin, idx.begin() + mid, idx.begin() + end,
+		[&lights, axis](int a, int b) {
+			return coord(lights[a].pos, axis) < coord(lights[b].pos, axis);
+		});
+
+	int left = build_node(scene, idx, begin, mid);
+	int right = build_node(scene, idx, mid, end);
+	light_tree[n].left = left;
+	light_tree[n].right = right;
+	return n;
+}
+
+void build_light_tree(Scene &scene) {
+	scene.light_tree.clear();
+	scene.light_ambient[0] = scene.light_ambient[1] = scene.light_ambient[2] = 0;
+	for (const Light &l : scene.lights) {
+		for (int i = 0; i < 3; ++i) {
+			scene.light_ambient[i] += l.ambient[i];
+		}
+	}
+	if (scene.lights.empty()) {
+		return;
+	}
+	std::vector<int> idx(scene.lights.size());
+	for (unsigned int i = 0; i < scene.lights.size(); ++i) {
+		idx[i] = i;
+	}
+	build_node(scene, idx, 0, idx.size());
+}
+
+// Upper estimate of the light reaching q from everything in the node
+static float importance(const Scene &scene, const LightNode &node, const Point &q,
+		const Vector &norm) {
+	Vector p = {q.x, q.y, q.z};
+
+	// nothing in the node is above the surface
+	bool above = false;
+	for (int c = 0; c < 8 && !above; ++c) {
+		Vector corner;
+		corner.x = (c & 1) ? node.bbmax.x : node.bbmin.x;
+		corner.y = (c & 2) ? node.bbmax.y : node.bbmin.y;
+		corner.z = (c & 4) ? node.bbmax.z : node.bbmin.z;
+		above = dot(corner - p, norm) > 0;
+	}
+	if (!above) {
+		return 0;
+	}
+
+	Vector d;
+	for (int a = 0; a < 3; ++a) {
+		d[a] = std::max(std::max(node.bbmin[a] - p[a], p[a] - node.bbmax[a]), 0.f);
+	}
+	float dist = length(d);
+	float decay = scene.decay_a + scene.decay_b * dist + scene.decay_c * dist * dist;
+	return node.power / std::max(decay, 0.0001f);
+}
+
+int sample_light(const Scene &scene, const Point &q, const Vector &norm, float u, float &pdf) {
+	const std::vector<LightNode> &light_tree = scene.light_tree;
+	if (light_tree.empty()) {
+		return -1;
+	}
+	pdf = 1;
+	int n = 0;
+	while (light_tree[n].light == -1) {
+		const LightNode &node = light_tree[n];
+		float il = importance(scene, light_tree[node.left], q, norm);
+		float ir = importance(scene, light_tree[node.right], q, norm);
+		if (il + ir <= 0) {
+			return -1;
+		}
+		// reuse u for the next level by rescaling it into [0, 1)
+		float pl = il / (il + ir);
+		if (u < pl) {
+			u = u / pl;
+			pdf *= pl;
+			n = node.left;
+		} else {
+			u = (u - pl) / (1 - pl);
+			pdf *= 1 - pl;
+			n = node.right;
+		}
+		u = std::min(u, 0.99999f);
+	}
+	return light_tree[n].light;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+/**********************************************************************
+ * Point and area lights, and the light tree used to sample them
+ **********************************************************************/
+#include <vector>
+#include "vector.h"
+
+struct Scene;
+
+enum LightShape {
+	LIGHT_POINT,
+	LIGHT_RECT,	// a parallelogram with sides edge_u and edge_v
+	LIGHT_SPHERE	// a sphere of radius
+};
+
+struct Light {
+	Point pos;	// the centre of area lights
+	float ambient[3];
+	float diffuse[3];
+	float specular[3];
+
+	LightShape shape = LIGHT_POINT;
+	Vector edge_u;
+	Vector edge_v;
+	float radius = 0;
+};
+
+// Node of the light tree. Leaves hold a single light, inner nodes the
+// bounds and summed intensity of everything below them.
+struct LightNode {
+	Vector bbmin;
+	Vector bbmax;
+	float power;
+	int left;
+	int right;
+	int light;
+};
+
+// The point (u, v) in [0, 1) x [0, 1) of the light as seen from q. Spheres
+// are sampled on the disc through their centre facing q, which is close
+// to their outline while q is a few radii away.
+Point light_point(const Light &light, const Point &q, float u, float v);
+
+// Builds the light tree of the lights of the scene, see prepare_scene
+void build_light_tree(Scene &scene);
+
+// Walks the light tree choosing children by their estimated contribution
+// at q. Returns the index of the chosen light and its probability in pdf,
+// or -1 if no light can reach q.
+int sample_light(const Scene &scene, const Point &q, const Vector &norm, float u, float &pdf);
@@ -0,0 +1,108 @@
+/**********************************************************************
+ * Measures the error and speed of the fast math functions of +m
+ * (fastmath.h) against the exact ones, over the kind of inputs shading
+ * gives them.
+ *
+ *   ./mathcheck [samples]
+ *
+ * Exits with 1 if any function is off by more than its bound. The error
+ * a whole render gets from +m is checked by make check_fastmath.
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "fastmath.h"
+
+// times each function is timed, the fastest is reported
+#define CHECK_REPEATS 7
+
+static int failures = 0;
+
+//
+// Largest error of fast against exact over the inputs, relative above 1
+// and absolute below, as colours and directions are around 1
+//
+template <typename Fast, typename Exact>
+static double max_error(const std::vector<float> &in, Fast fast, Exact exact) {
+	double worst = 0;
+	for (float x : in) {
+		double e = exact(x);
+		double err = fabs(fast(x) - e) / std::max(fabs(e), 1.0);
+		worst = std::max(worst, err);
+	}
+	return worst;
+}
+
+//
+// ns per call of f over the inputs, the best of CHECK_REPEATS tries
+//
+template <typename Op>
+static double time_op(const std::vector<float> &in, Op f) {
+	double best = 0;
+	volatile float sink = 0;
+	for (int t = 0; t < CHECK_REPEATS; ++t) {
+		float sum = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (float x : in) {
+			sum += f(x);
+		}
+		auto end = std::chrono::steady_clock::now();
+		sink = sink + sum;
+		double ns = std::chrono::duration<double, std::nano>(end - start).count() / in.size();
+		best = t == 0 || ns < best ? ns : best;
+	}
+	return best;
+}
+
+template <typename Fast, typename Exact>
+static void check(const char *name, const std::vector<float> &in, double bound, Fast fast,
+		Exact exact) {
+	double err = max_error(in, fast, exact);
+	double t_exact = time_op(in, exact);
+	double t_fast = time_op(in, fast);
+	printf("  %-12s %10.2e %10.2e %8.2f %8.2f %6.2fx%s\n", name, err, bound, t_exact, t_fast,
+		t_exact / t_fast, err > bound ? "  FAIL" : "");
+	if (err > bound) {
+		failures++;
+	}
+}
+
+int main(int argc, char **argv) {
+	int samples = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	std::default_random_engine rng(1);
+	std::uniform_real_distribution<float> cosine(-1, 1);
+	std::uniform_real_distribution<float> exponent(-20, 20);
+	std::vector<float> cosines(samples), lengths(samples);
+	for (int i = 0; i < samples; ++i) {
+		cosines[i] = cosine(rng);
+		// squared lengths of light and view vectors
+		lengths[i] = powf(2, exponent(rng));
+	}
+
+	printf("  %-12s %10s %10s %8s %8s\n", "", "error", "bound", "exact", "fast");
+	printf("  %-12s %10s %10s %8s %8s\n", "", "", "", "ns", "ns");
+	// the shininess of the scenes
+	static const float shines[] = {6, 10, 30};
+	for (float s : shines) {
+		char name[32];
+		snprintf(name, sizeof(name), "pow(x, %g)", s);
+		check(name, cosines, 1e-5,
+			[s](float x) { return fast_pow(x, s); },
+			[s](float x) { return powf(x, s); });
+	}
+	check("rsqrt", lengths, 1e-5,
+		[](float x) { return fast_rsqrt(x); },
+		[](float x) { return 1 / sqrtf(x); });
+
+	if (failures > 0) {
+		return 1;
+	}
+	printf("All within bounds\n");
+	return 0;
+}
@@ -1,9 +1,54 @@
 #include "model.h"
+#include "global.h"
+#include "trace.h"
 #include <cstdio>
 #include <cmath>
+#include <chrono>
+#include <algorithm>
 
-Model::Model(const std::string &filename, const Vector &off) : bbtop({0,0,0}), bbbottom({0,0,0}) {
+static float signNotZero(float v) {
+	return v >= 0 ? 1.f : -1.f;
+}
+
+// Based on "A Survey of Efficient Representations for Independent Unit
+// Vectors", Cigolle et al. 2014
+static PackedNormal encodeNormal(const Vector &n) {
+	float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	float x = n.x / l1;
+	float y = n.y / l1;
+	if (n.z < 0) {
+		float ox = x;
+		x = (1 - fabs(y)) * signNotZero(ox);
+		y = (1 - fabs(ox)) * signNotZero(y);
+	}
+	return {(int16_t)roundf(x * 32767), (int16_t)roundf(y * 32767)};
+}
+
+static Vector decodeNormal(const PackedNormal &p) {
+	Vector n;
+	n.x = p.x / 32767.f;
+	n.y = p.y / 32767.f;
+	n.z = 1 - fabs(n.x) - fabs(n.y);
+	if (n.z < 0) {
+		float ox = n.x;
+		n.x = (1 - fabs(n.y)) * signNotZero(ox);
+		n.y = (1 - fabs(ox)) * signNotZero(n.y);
+	}
+	return normalize(n);
+}
+
+//
+// Reads an SMF file: a "# vertices faces" line followed by the vertex and
+// face lines, with indices from 1. Prints an error and gives an empty mesh
+// when the file can't be opened.
+//
+MeshData read_smf(const std::string &filename) {
+	MeshData mesh;
 	FILE *f = fopen(filename.c_str(), "r");
+	if (!f) {
+		printf("Unable to open file '%s'\n", filename.c_str());
+		return mesh;
+	}
 
 	int verts, faces;
 	fscanf(f, "# %d %d\n", &verts, &faces);
@@ -11,29 +56,7 @@ Model::Model(const std::string &filename, const Vector &off) : bbtop({0,0,0}), b
 	for (int i = 0; i < verts; ++i) {
 		float x,y,z;
 		fscanf(f, "v %f %f %f\n", &x, &y, &z);
-		x += off.x;
-		y += off.y;
-		z += off.z;
-		if (i == 0 || x > bbtop.x) {
-			bbtop.x = x;
-		}
-		if (i == 0 || y > bbtop.y) {
-			bbtop.y = y;
-		}
-		if (i == 0 || z > bbtop.z) {
-			bbtop.z = z;
-		}
-		if (i == 0 || x < bbbottom.x) {
-			bbbottom.x = x;
-		}
-		if (i == 0 || y < bbbottom.y) {
-			bbbottom.y = y;
-		}
-		if (i == 0 || z < bbbottom.z) {
-			bbbottom.z = z;
-		}
-
-		_vertices.push_back({x,y,z});
+		mesh.vertices.push_back({x,y,z});
 	}
 
 	for (int i = 0; i < faces; ++i) {
@@ -42,18 +65,57 @@ Model::Model(const std::string &filename, const Vector &off) : bbtop({0,0,0}), b
 		x--;
 		y--;
 		z--;
+		mesh.faces.push_back({x,y,z, {0,0,0}});
+	}
+	fclose(f);
+	return mesh;
+}
+
+Model::Model(const std::string &filename, const Vector &off, bool compact) :
+		Model(filename, read_smf(filename), off, compact) {}
+
+Model::Model(const std::string &name, const MeshData &mesh, const Vector &off, bool compact) :
+		_name(name), _offset(off), _faces(mesh.faces), _compact(false), bbtop({0,0,0}), bbbottom({0,0,0}) {
+	_vertices.reserve(mesh.vertices.size());
+	for (const Vector &v : mesh.vertices) {
+		_vertices.push_back({v.x + off.x, v.y + off.y, v.z + off.z});
+	}
+	setUp(compact);
+}
+
+//
+// Finds the bounds, face normals and feature size of the loaded mesh and
+// gives it the default material
+//
+void Model::setUp(bool compact) {
+	for (unsigned int i = 0; i < _vertices.size(); ++i) {
+		const Vector &v = _vertices[i];
+		for (int a = 0; a < 3; ++a) {
+			if (i == 0 || v[a] > bbtop[a]) {
+				bbtop[a] = v[a];
+			}
+			if (i == 0 || v[a] < bbbottom[a]) {
+				bbbottom[a] = v[a];
+			}
+		}
+	}
+
+	float area = 0;
+	for (Face &face : _faces) {
 		//Based on https://www.opengl.org/wiki/Calculating_a_Surface_Normal
-		Vector norm;
-		Vector v1 = _vertices[x];
-		Vector v2 = _vertices[y];
-		Vector v3 = _vertices[z];
+		Vector v1 = _vertices[face.x];
+		Vector v2 = _vertices[face.y];
+		Vector v3 = _vertices[face.z];
 		Vector u = v2 - v3;
 		Vector v = v1 - v3;
-		norm = normalize(cross(v,u));
+		face.norm = normalize(cross(v,u));
 
-		_faces.push_back({x,y,z, norm});
+		area += length(cross(v2 - v1, v3 - v1)) / 2;
 	}
-	fclose(f);
+	// the side of a square with the average area of a face
+	_featureSize = _faces.empty() ? 0 : sqrtf(area / _faces.size());
+	_lodmin = bbbottom;
+	_lodmax = bbtop;
 
 	mat_ambient[0] = 0.7;
 	mat_ambient[1] = 0.7;
@@ -70,21 +132,191 @@ Model::Model(const std::string &filename, const Vector &off) : bbtop({0,0,0}), b
 	mat_shineness = 30;
 	reflectance = 0.5;
 	transparency = 0.5;
+
+	if (compact) {
+		this->compact();
+	}
 }
 
-// Moller-Trumbore intersection
-float Model::intersect(const Point &r, const Vector &ray, IntersectionInfo &out) const {
+void Model::addLOD(const std::string &filename) {
+	addLOD(new Model(filename, _offset, _compact));
+}
 
-	Vector o = {r.x, r.y, r.z};
-	Vector lb = bbtop;
-	Vector rt = bbbottom;
+void Model::addLODs(const std::vector<MeshData> &levels) {
+	for (const MeshData &mesh : levels) {
+		char name[32];
+		sprintf(name, " LOD %d", (int)_lods.size() + 1);
+		addLOD(new Model(_name + name, mesh, _offset, _compact));
+	}
+}
 
-	// based on https://gamedev.stackexchange.com/questions/18436/most-efficient-aabb-vs-ray-collision-algorithms/18459#18459
-	// r.dir is unit direction vector of ray
-	Vector dirfrac;
-	dirfrac.x = 1.0f / ray.x;
-	dirfrac.y = 1.0f / ray.y;
-	dirfrac.z = 1.0f / ray.z;
+void Model::addLOD(Model *lod) {
+	_lods.push_back(std::unique_ptr<Model>(lod));
+	for (int a = 0; a < 3; ++a) {
+		_lodmin[a] = std::min(_lodmin[a], lod->bbbottom[a]);
+		_lodmax[a] = std::max(_lodmax[a], lod->bbtop[a]);
+	}
+}
+
+// Converts the mesh to the compact representation and releases the full
+// precision arrays.
+void Model::compact() {
+	Vector extent = bbtop - bbbottom;
+	_qscale.x = extent.x / 65535;
+	_qscale.y = extent.y / 65535;
+	_qscale.z = extent.z / 65535;
+
+	_qvertices.reserve(_vertices.size() * 3);
+	for (const Vector &v : _vertices) {
+		for (int i = 0; i < 3; ++i) {
+			float q = 0;
+			if (extent[i] > 0) {
+				q = roundf((v[i] - bbbottom[i]) / extent[i] * 65535);
+			}
+			_qvertices.push_back((uint16_t)q);
+		}
+	}
+
+	bool small = _vertices.size() <= 65536;
+	for (const Face &f : _faces) {
+		if (small) {
+			_indices16.push_back(f.x);
+			_indices16.push_back(f.y);
+			_indices16.push_back(f.z);
+		} else {
+			_indices32.push_back(f.x);
+			_indices32.push_back(f.y);
+			_indices32.push_back(f.z);
+		}
+		_normals.push_back(encodeNormal(f.norm));
+	}
+
+	std::vector<Vector>().swap(_vertices);
+	std::vector<Face>().swap(_faces);
+	_compact = true;
+}
+
+size_t Model::memoryUsage() const {
+	return _vertices.size() * sizeof(Vector) + _faces.size() * sizeof(Face) +
+		_qvertices.size() * sizeof(uint16_t) +
+		_indices16.size() * sizeof(uint16_t) +
+		_indices32.size() * sizeof(uint32_t) +
+		_normals.size() * sizeof(PackedNormal);
+}
+
+int Model::numFaces() const {
+	return _compact ? _normals.size() : _faces.size();
+}
+
+void Model::getTriangle(int i, Vector &v1, Vector &v2, Vector &v3) const {
+	if (!_compact) {
+		const Face &f = _faces[i];
+		v1 = _vertices[f.x];
+		v2 = _vertices[f.y];
+		v3 = _vertices[f.z];
+		return;
+	}
+
+	uint32_t idx[3];
+	if (!_indices16.empty()) {
+		idx[0] = _indices16[i * 3];
+		idx[1] = _indices16[i * 3 + 1];
+		idx[2] = _indices16[i * 3 + 2];
+	} else {
+		idx[0] = _indices32[i * 3];
+		idx[1] = _indices32[i * 3 + 1];
+		idx[2] = _indices32[i * 3 + 2];
+	}
+	Vector *out[3] = {&v1, &v2, &v3};
+	for (int j = 0; j < 3; ++j) {
+		const uint16_t *q = &_qvertices[idx[j] * 3];
+		out[j]->x = bbbottom.x + q[0] * _qscale.x;
+		out[j]->y = bbbottom.y + q[1] * _qscale.y;
+		out[j]->z = bbbottom.z + q[2] * _qscale.z;
+	}
+}
+
+//
+// Puts the faces in the order the leaves of the BVH refer to them
+//
+void Model::reorderFaces(const std::vector<int> &order) {
+	if (!_compact) {
+		std::vector<Face> faces(order.size());
+		for (unsigned int k = 0; k < order.size(); ++k) {
+			faces[k] = _faces[order[k]];
+		}
+		_faces.swap(faces);
+		return;
+	}
+
+	std::vector<PackedNormal> normals(order.size());
+	for (unsigned int k = 0; k < order.size(); ++k) {
+		normals[k] = _normals[order[k]];
+	}
+	_normals.swap(normals);
+
+	std::vector<uint16_t> &idx16 = _indices16;
+	std::vector<uint32_t> &idx32 = _indices32;
+	std::vector<uint16_t> new16(idx16.size());
+	std::vector<uint32_t> new32(idx32.size());
+	for (unsigned int k = 0; k < order.size(); ++k) {
+		for (int j = 0; j < 3; ++j) {
+			if (!idx16.empty()) {
+				new16[k * 3 + j] = idx16[order[k] * 3 + j];
+			} else {
+				new32[k * 3 + j] = idx32[order[k] * 3 + j];
+			}
+		}
+	}
+	idx16.swap(new16);
+	idx32.swap(new32);
+}
+
+//
+// The build is a job, so the threads that need it while it runs help with
+// it and its BVH jobs (or anything else queued) instead of blocking
+//
+void Model::prepare() const {
+	if (_unbuilt.load(std::memory_order_acquire) == 0) {
+		return;
+	}
+	if (!_building.exchange(true)) {
+		queue_job([this] {
+			const_cast<Model *>(this)->build();
+			for (const auto &lod : _lods) {
+				lod->prepare();
+			}
+			_unbuilt--;
+		});
+	}
+	wait_jobs(_unbuilt);
+}
+
+void Model::build() {
+	auto start = std::chrono::steady_clock::now();
+
+	int size = numFaces();
+	std::vector<Vector> fmin(size), fmax(size);
+	for (int i = 0; i < size; ++i) {
+		Vector v[3];
+		getTriangle(i, v[0], v[1], v[2]);
+		for (int a = 0; a < 3; ++a) {
+			fmin[i][a] = std::min(std::min(v[0][a], v[1][a]), v[2][a]);
+			fmax[i][a] = std::max(std::max(v[0][a], v[1][a]), v[2][a]);
+		}
+	}
+	std::vector<int> order;
+	_bvh.build(fmin, fmax, order);
+	reorderFaces(order);
+
+	auto end = std::chrono::steady_clock::now();
+	printf("BVH for %s: %d faces, %d nodes in %.1f ms\n", _name.c_str(), size,
+		(int)_bvh.nodes.size(),
+		std::chrono::duration<float, std::milli>(end - start).count());
+}
+
+// based on https://gamedev.stackexchange.com/questions/18436/most-efficient-aabb-vs-ray-collision-algorithms/18459#18459
+static bool hitBox(const Vector &lb, const Vector &rt, const Vector &o, const Vector &dirfrac, float &tmin) {
 	// lb is the corner of AABB with minimal coordinates - left bottom, rt is maximal corner
 	// r.org is origin of ray
 	float t1 = (lb.x - o.x)*dirfrac.x;
@@ -94,68 +326,181 @@ float Model::intersect(const Point &r, const Vector &ray, IntersectionInfo &out)
 	float t5 = (lb.z - o.z)*dirfrac.z;
 	float t6 = (rt.z - o.z)*dirfrac.z;
 
-	float tmin = std::max(std::max(std::min(t1, t2), std::min(t3, t4)), std::min(t5, t6));
+	tmin = std::max(std::max(std::min(t1, t2), std::min(t3, t4)), std::min(t5, t6));
 	float tmax = std::min(std::min(std::max(t1, t2), std::max(t3, t4)), std::max(t5, t6));
 
 	// if tmax < 0, ray (line) is intersecting AABB, but whole AABB is behing us
 	if (tmax < 0) {
-		return -1;
+		return false;
 	}
 
 	// if tmin > tmax, ray doesn't intersect AABB
 	if (tmin > tmax) {
+		return false;
+	}
+	return true;
+}
+
+// Moller-Trumbore intersection
+float Model::intersectFace(int i, const Vector &o, const Vector &ray) const {
+	Vector v1, v2, v3;
+	getTriangle(i, v3, v2, v1);
+
+	Vector e1 = v2-v1;
+	Vector e2 = v3-v1;
+	Vector p = cross(ray, e2);
+	float det = dot(e1, p);
+
+	if (fabs(det) < 0.000001f) {
 		return -1;
 	}
+	float inv_det = 1.f/det;
 
-	float closest = -1;
-	bool notfound = true;
-	int size = _faces.size();
-	for (int i = 0; i < size; ++i) {
-		const Face &f = _faces[i];
-		Vector v3 = _vertices[f.x];
-		Vector v2 = _vertices[f.y];
-		Vector v1 = _vertices[f.z];
+	Vector t = o - v1;
 
-		Vector e1 = v2-v1;
-		Vector e2 = v3-v1;
-		Vector p = cross(ray, e2);
-		float det = dot(e1, p);
+	float u = dot(t, p) * inv_det;
 
-		if (fabs(det) < 0.000001f) {
-			continue;
-		}
-		float inv_det = 1.f/det;
+	if (u < 0.f || u > 1.f) {
+		return -1;
+	}
 
-		Vector t = o - v1;
+	Vector q = cross(t, e1);
+	float v = dot(ray, q) * inv_det;
 
-		float u = dot(t, p) * inv_det;
+	if (v < 0.f || v + u > 1.f) {
+		return -1;
+	}
+	float t2 = dot(e2, q) * inv_det;
+	if (t2 > 0.0001f) {
+		return t2;
+	}
+	return -1;
+}
+
+float Model::intersect(const Point &r, const Vector &ray, IntersectionInfo &out) const {
+	Vector o = {r.x, r.y, r.z};
 
-		if (u < 0.f || u > 1.f) {
-			continue;
+	// r.dir is unit direction vector of ray
+	Vector dirfrac;
+	dirfrac.x = 1.0f / ray.x;
+	dirfrac.y = 1.0f / ray.y;
+	dirfrac.z = 1.0f / ray.z;
+
+	float tmin;
+	if (!hitBox(_lodmin, _lodmax, o, dirfrac, tmin)) {
+		return -1;
+	}
+	prepare();
+
+	// Use the coarsest level whose faces are still smaller than the ray's
+	// cone where it reaches the model
+	int lod = 0;
+	if (out.cone.surface == this) {
+		lod = out.cone.lod;
+	} else {
+		float footprint = (out.cone.width + out.cone.spread * std::max(tmin, 0.0f)) * LOD_SCALE;
+		while (lod < (int)_lods.size() && _lods[lod]->_featureSize <= footprint) {
+			++lod;
 		}
+	}
+	const Model *level = lod == 0 ? this : _lods[lod - 1].get();
 
-		Vector q = cross(t, e1);
-		float v = dot(ray, q) * inv_det;
+	int face = -1;
+	float closest = level->intersectMesh(o, ray, dirfrac, tmin, face, out.face_tests);
+	if (face == -1) {
+		return -1;
+	}
+	Vector sc = ray * closest;
+	out.pos.x = o.x + sc.x;
+	out.pos.y = o.y + sc.y;
+	out.pos.z = o.z + sc.z;
+	out.vertex = face;
+	out.lod = lod;
+	return closest;
+}
 
-		if (v < 0.f || v + u > 1.f) {
-			continue;
+//
+// Finds the closest face the ray hits, starting the BVH walk at tmin.
+// Returns the distance, or -1 with face left at -1. The faces tested are
+// added to tests.
+//
+float Model::intersectMesh(const Vector &o, const Vector &ray, const Vector &dirfrac, float tmin,
+		int &face, int &tests) const {
+	float closest = -1;
+	if (_bvh.empty()) {
+		int size = numFaces();
+		tests += size;
+		for (int i = 0; i < size; ++i) {
+			float t = intersectFace(i, o, ray);
+			if (t != -1 && (face == -1 || t < closest)) {
+				face = i;
+				closest = t;
+			}
 		}
-		float t2 = dot(e2, q) * inv_det;
-		if (t2 > 0.0001f) {
-			if (notfound || t2 < closest) {
-				notfound = false;
-				Vector sc = ray * t2;
-				out.pos.x = o.x + sc.x;
-				out.pos.y = o.y + sc.y;
-				out.pos.z = o.z + sc.z;
-				out.vertex = i;
-				closest = t2;
+	} else {
+		// visit the nearer child first, and skip nodes past the closest hit.
+		// Every level leaves at most one sibling waiting.
+		struct Entry {
+			int node;
+			float tmin;
+		} stack[BVH_MAX_DEPTH + 1];
+		int sp = 0;
+		stack[sp++] = {0, tmin};
+		while (sp > 0) {
+			Entry e = stack[--sp];
+			if (face != -1 && e.tmin > closest) {
+				continue;
+			}
+			const BVHNode &node = _bvh.nodes[e.node];
+			if (node.count > 0) {
+				tests += node.count;
+				for (int i = node.start; i < node.start + node.count; ++i) {
+					float t = intersectFace(i, o, ray);
+					if (t != -1 && (face == -1 || t < closest)) {
+						face = i;
+						closest = t;
+					}
+				}
+				continue;
+			}
+
+			const BVHNode &left = _bvh.nodes[node.start];
+			const BVHNode &right = _bvh.nodes[node.start + 1];
+			float tl, tr;
+			bool hl = hitBox(left.bbmin, left.bbmax, o, dirfrac, tl);
+			bool hr = hitBox(right.bbmin, right.bbmax, o, dirfrac, tr);
+			if (hl && hr) {
+				if (tl < tr) {
+					stack[sp++] = {node.start + 1, tr};
+					stack[sp++] = {node.start, tl};
+				} else {
+					stack[sp++] = {node.start, tl};
+					stack[sp++] = {node.start + 1, tr};
+				}
+			} else if (hl) {
+				stack[sp++] = {node.start, tl};
+			} else if (hr) {
+				stack[sp++] = {node.start + 1, tr};
 			}
 		}
 	}
+
 	return closest;
 }
 
 Vector Model::getNormal(const IntersectionInfo &info) const {
+	if (info.lod > 0) {
+		IntersectionInfo fine = info;
+		fine.lod = 0;
+		return _lods[info.lod - 1]->getNormal(fine);
+	}
+	if (_compact) {
+		return decodeNormal(_normals[info.vertex]);
+	}
 	return _faces[info.vertex].norm;
 }
+
+void Model::getBounds(Vector &min, Vector &max) const {
+	min = _lodmin;
+	max = _lodmax;
+}
@@ -2,8 +2,13 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <atomic>
+#include <memory>
 #include "vector.h"
 #include "sphere.h"
+#include "bvh.h"
+#include "global.h"
 
 struct Face {
 	int x;
@@ -12,14 +17,83 @@ struct Face {
 	Vector norm;
 };
 
+// Octahedral encoded unit normal
+struct PackedNormal {
+	int16_t x;
+	int16_t y;
+};
+
+// A mesh as it is read from a file
+struct MeshData {
+	std::vector<Vector> vertices;
+	std::vector<Face> faces;	// normals are filled in by Model
+};
+
+MeshData read_smf(const std::string &filename);
+
 class Model : public Object {
 public:
-	Model(const std::string &filename, const Vector &);
+	Model(const std::string &filename, const Vector &, bool compact = false);
+	// A model of a mesh that has already been read, moved by off
+	Model(const std::string &name, const MeshData &mesh, const Vector &off, bool compact = false);
+	// Adds a coarser version of the mesh, loaded with the same offset. Add
+	// them from finest to coarsest.
+	void addLOD(const std::string &filename);
+	// Adds a model of each mesh as a coarser level of detail, moved by the
+	// same offset. The meshes are shared by every model of the file, see
+	// simplified_lods.
+	void addLODs(const std::vector<MeshData> &levels);
 	float intersect(const Point &ray, const Vector &o, IntersectionInfo &out) const;
 	Vector getNormal(const IntersectionInfo &) const override;
+	void getBounds(Vector &min, Vector &max) const override;
+	// bytes of the vertices, faces and normals, compact or not
+	size_t memoryUsage() const;
+	int numFaces() const;
+	void getTriangle(int i, Vector &v1, Vector &v2, Vector &v3) const;
+
+	// Builds the BVH over the faces unless it already exists. Called by the
+	// first ray that reaches the model's bounding box, and by anything
+	// that keeps face indices (which the build reorders).
+	void prepare() const;
 private:
+	void setUp(bool compact);
+	void addLOD(Model *lod);
+	void build();
+	void compact();
+	void reorderFaces(const std::vector<int> &order);
+	float intersectFace(int i, const Vector &o, const Vector &ray) const;
+	float intersectMesh(const Vector &o, const Vector &ray, const Vector &dirfrac, float tmin,
+		int &face, int &tests) const;
+
+	std::string _name;
+	Vector _offset;
+
+	// Coarser levels of detail, and the average size of the triangles of
+	// this one
+	std::vector<std::unique_ptr<Model>> _lods;
+	float _featureSize;
+	// bounds of every level
+	Vector _lodmin;
+	Vector _lodmax;
+
 	std::vector<Vector> _vertices;
 	std::vector<Face> _faces;
+
+	// Compact storage. Positions are quantized to 16 bits inside the
+	// bounding box, indices are 16 bit when the mesh is small enough.
+	bool _compact;
+	std::vector<uint16_t> _qvertices;
+	std::vector<uint16_t> _indices16;
+	std::vector<uint32_t> _indices32;
+	std::vector<PackedNormal> _normals;
+	Vector _qscale;
+
+	BVH _bvh;
+	// 1 until the BVHs of every level are built, counted down by the job
+	// that builds them, which the first thread to need them queues
+	mutable std::atomic<int> _unbuilt{1};
+	mutable std::atomic<bool> _building{false};
+
 	Vector bbtop;
 	Vector bbbottom;
 };
@@ -56,6 +56,14 @@ Vector Plane::getNormal(const IntersectionInfo &info) const {
 	return normal;
 }
 
+// The plane is clipped in x and z only
+void Plane::getBounds(Vector &min, Vector &max) const {
+	min = Vector(_a.x, -1e30f, _a.z);
+	max = Vector(_b.x, 1e30f, _b.z);
+	if (normal.x == 0 && normal.z == 0) {
+		min.y = max.y = _pos.y;
+	}
+}
 
 float Plane::getDiffuse(const Point &p, int i) const {
 	int x = ((p.x - _a.x) * 8) / 6;
@@ -10,6 +10,7 @@ public:
 	virtual float intersect(const Point &, const Vector &, IntersectionInfo &) const;
 	virtual Vector getNormal(const IntersectionInfo &) const;
 	virtual float getDiffuse(const Point &, int) const;
+	virtual void getBounds(Vector &min, Vector &max) const;
 
 private:
 	Vector normal, _a, _b;
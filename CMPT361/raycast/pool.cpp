@@ -0,0 +1,160 @@
+#include <algorithm>
+#include "pool.h"
+
+RenderFrame::RenderFrame(int tiles, std::function<void()> finish) :
+		_remaining(tiles), _cancelled(false), _finish(std::move(finish)) {
+	_done = _promise.get_future().share();
+	if (tiles == 0) {
+		_remaining = 1;
+		finishTile();
+	}
+}
+
+void RenderFrame::finishTile() {
+	if (--_remaining == 0) {
+		if (_finish && !_cancelled) {
+			_finish();
+		}
+		_promise.set_value();
+	}
+}
+
+RenderPool::RenderPool(unsigned int count) : _waiting(0), _stopping(false) {
+	for (unsigned int i = 0; i < count; ++i) {
+		_threads.push_back(std::thread(&RenderPool::work, this));
+	}
+}
+
+RenderPool::~RenderPool() {
+	std::deque<Tile> dropped;
+	_mutex.lock();
+	_stopping = true;
+	dropped.swap(_tiles);
+	_mutex.unlock();
+	_condition.notify_all();
+	for (auto &t : _threads) {
+		t.join();
+	}
+	// nobody will run these, but their frames still need to finish
+	for (Tile &t : dropped) {
+		t.frame->cancel();
+		t.frame->finishTile();
+	}
+}
+
+std::shared_ptr<RenderFrame> RenderPool::submit(std::vector<std::function<void()>> tiles,
+		std::function<void()> finish) {
+	auto frame = std::make_shared<RenderFrame>(tiles.size(), std::move(finish));
+	_mutex.lock();
+	for (auto &fn : tiles) {
+		_tiles.push_back({frame, std::move(fn)});
+	}
+	_mutex.unlock();
+	_condition.notify_all();
+	return frame;
+}
+
+void RenderPool::queue_job(std::function<void()> job) {
+	_mutex.lock();
+	_jobs.push_back(std::move(job));
+	_mutex.unlock();
+	_condition.notify_one();
+}
+
+void RenderPool::wait_jobs(std::atomic<int> &pending) {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (pending > 0) {
+		if (_jobs.size() == 0) {
+			// woken by new jobs and by jobs that end, which is when pending
+			// counts down
+			_waiting++;
+			_condition.wait(lock);
+			_waiting--;
+			continue;
+		}
+		std::function<void()> job = std::move(_jobs.front());
+		_jobs.pop_front();
+		lock.unlock();
+		job();
+		lock.lock();
+		jobDone();
+	}
+}
+
+void RenderPool::jobDone() {
+	if (_waiting > 0) {
+		_condition.notify_all();
+	}
+}
+
+void RenderPool::parallel_for(int count, const std::function<void(int)> &fn) {
+	std::atomic<int> pending(count - 1);
+	for (int k = 1; k < count; ++k) {
+		queue_job([&, k] {
+			fn(k);
+			pending--;
+		});
+	}
+	if (count > 0) {
+		fn(0);
+	}
+	wait_jobs(pending);
+}
+
+void RenderPool::work() {
+	while (1) {
+		std::function<void()> job;
+		Tile tile;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_condition.wait(lock, [this] {
+				return _jobs.size() != 0 || _tiles.size() != 0 || _stopping;
+			});
+			if (_stopping) {
+				break;
+			}
+			if (_jobs.size() != 0) {
+				job = std::move(_jobs.front());
+				_jobs.pop_front();
+			} else {
+				tile = std::move(_tiles.front());
+				_tiles.pop_front();
+			}
+		}
+		if (job) {
+			job();
+			std::lock_guard<std::mutex> lock(_mutex);
+			jobDone();
+		} else {
+			if (!tile.frame->cancelled()) {
+				tile.fn();
+			}
+			tile.frame->finishTile();
+		}
+	}
+}
+
+static std::unique_ptr<RenderPool> pool;
+static std::mutex pool_mutex;
+static int pool_threads = 0;
+
+void set_render_threads(int count) {
+	pool_threads = std::max(0, count);
+}
+
+RenderPool &render_pool() {
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	if (!pool) {
+		unsigned int count = pool_threads;
+		if (count == 0) {
+			count = std::max(1u, std::thread::hardware_concurrency());
+		}
+		pool.reset(new RenderPool(count));
+	}
+	return *pool;
+}
+
+void shutdown_render_pool() {
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	pool.reset();
+}
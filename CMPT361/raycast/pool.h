@@ -0,0 +1,82 @@
+#pragma once
+
+/**********************************************************************
+ * Render threads that live for the whole process. Frames are submitted
+ * as a list of tiles and finish through a future.
+ **********************************************************************/
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class RenderFrame {
+public:
+	// finish runs on the thread that completes the last tile, before the
+	// future is ready. It is skipped for cancelled frames.
+	RenderFrame(int tiles, std::function<void()> finish = nullptr);
+
+	// Tiles that haven't started yet are skipped. The future is ready once
+	// the running ones finish.
+	void cancel() { _cancelled = true; }
+	bool cancelled() const { return _cancelled; }
+	std::shared_future<void> done() const { return _done; }
+
+	// called once per tile, run or skipped
+	void finishTile();
+private:
+	std::atomic<int> _remaining;
+	std::atomic<bool> _cancelled;
+	std::function<void()> _finish;
+	std::promise<void> _promise;
+	std::shared_future<void> _done;
+};
+
+class RenderPool {
+public:
+	RenderPool(unsigned int count);
+	~RenderPool();
+
+	std::shared_ptr<RenderFrame> submit(std::vector<std::function<void()>> tiles,
+		std::function<void()> finish = nullptr);
+
+	// Jobs run before any tile. Used for work that someone is waiting on.
+	void queue_job(std::function<void()> job);
+	// Runs queued jobs on this thread until pending drops to zero, and
+	// sleeps while there are none. pending must only be counted down by
+	// jobs, as the end of a job is what wakes it. Never picks up tiles, so
+	// that a job started by a ray can't end up waiting on itself.
+	void wait_jobs(std::atomic<int> &pending);
+	// Runs fn(k) for k in [0, count) over the render threads
+	void parallel_for(int count, const std::function<void(int)> &fn);
+
+	unsigned int size() const { return _threads.size(); }
+private:
+	struct Tile {
+		std::shared_ptr<RenderFrame> frame;
+		std::function<void()> fn;
+	};
+	void work();
+	// wakes wait_jobs after a job, with _mutex held
+	void jobDone();
+
+	std::deque<Tile> _tiles;
+	std::deque<std::function<void()>> _jobs;
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	int _waiting;	// threads asleep in wait_jobs
+	bool _stopping;
+	std::vector<std::thread> _threads;
+};
+
+// The pool shared by the renderer, started on first use
+RenderPool &render_pool();
+// Threads of the shared pool, must be called before it starts. 0 (the
+// default) means one per processor.
+void set_render_threads(int count);
+// Stops and joins the threads of the shared pool
+void shutdown_render_pool();
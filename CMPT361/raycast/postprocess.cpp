@@ -0,0 +1,109 @@
+#include <cmath>
+#include <algorithm>
+
+#include "postprocess.h"
+#include "raycast.h"
+#include "pool.h"
+
+PostSettings post_settings = {false, 1, false, 1};
+
+// Rows per job. Jobs are small so the pool stays busy on uneven frames.
+#define POST_ROWS 16
+// Entries of the gamma table, indexed by the tone mapped value
+#define GAMMA_LUT_SIZE 4096
+
+float frame_max(const ImageBuffer &image) {
+	int bands = (win_height + POST_ROWS - 1) / POST_ROWS;
+	std::vector<float> band_max(bands);
+	render_pool().parallel_for(bands, [&](int k) {
+		const float *p = &image[k * POST_ROWS][0][0];
+		int n = (std::min(win_height, (k + 1) * POST_ROWS) - k * POST_ROWS) * WIN_WIDTH * 3;
+		float m = 0;
+		for (int i = 0; i < n; ++i) {
+			m = p[i] > m ? p[i] : m;
+		}
+		band_max[k] = m;
+	});
+	return *std::max_element(band_max.begin(), band_max.end());
+}
+
+//
+// Exposure, tone mapping and clipping of one row, the values are left in
+// [0, 1]
+//
+static void expose_row(const float *in, float *out, int n, float scale, bool tonemap) {
+	if (tonemap) {
+		for (int i = 0; i < n; ++i) {
+			float v = in[i] * scale;
+			v = v > 0 ? v : 0;
+			out[i] = v / (1 + v);
+		}
+	} else {
+		for (int i = 0; i < n; ++i) {
+			float v = in[i] * scale;
+			v = v > 0 ? v : 0;
+			out[i] = v < 1 ? v : 1;
+		}
+	}
+}
+
+/*********************************************************************
+ * Runs the whole post process in one pass over bands of POST_ROWS rows
+ * on the render threads: exposure (and normalization), tone mapping,
+ * gamma and quantization. The bytes go straight to out, which is
+ * usually the file buffer of an encoder.
+ *
+ * Linear output is quantized the same way the old save_image did, by
+ * truncating v * 255. Gamma goes through a table so there is no pow per
+ * pixel.
+ *********************************************************************/
+void develop_frame(const PostSettings &settings, unsigned char *out, int stride, bool bgr, bool flip,
+		const ImageBuffer &image) {
+	float scale = settings.exposure;
+	if (settings.normalize) {
+		float m = frame_max(image);
+		if (m > 0) {
+			scale /= m;
+		}
+	}
+
+	bool use_lut = settings.gamma != 1;
+	unsigned char lut[GAMMA_LUT_SIZE];
+	if (use_lut) {
+		for (int i = 0; i < GAMMA_LUT_SIZE; ++i) {
+			float v = std::pow(i / float(GAMMA_LUT_SIZE - 1), 1 / settings.gamma);
+			lut[i] = (unsigned char)(v * 255 + 0.5f);
+		}
+	}
+
+	int bands = (win_height + POST_ROWS - 1) / POST_ROWS;
+	render_pool().parallel_for(bands, [&](int k) {
+		int n = win_width * 3;
+		std::vector<float> row(n);
+		std::vector<unsigned char> bytes(n);
+		int y1 = std::min(win_height, (k + 1) * POST_ROWS);
+		for (int y = k * POST_ROWS; y < y1; ++y) {
+			expose_row(&image[y][0][0], &row[0], n, scale, settings.tonemap);
+			if (use_lut) {
+				for (int i = 0; i < n; ++i) {
+					bytes[i] = lut[(int)(row[i] * (GAMMA_LUT_SIZE - 1))];
+				}
+			} else {
+				for (int i = 0; i < n; ++i) {
+					bytes[i] = (unsigned char)(int)(row[i] * 255);
+				}
+			}
+
+			unsigned char *dst = out + (flip ? win_height - 1 - y : y) * stride;
+			if (bgr) {
+				for (int x = 0; x < win_width; ++x) {
+					dst[x * 3 + 0] = bytes[x * 3 + 2];
+					dst[x * 3 + 1] = bytes[x * 3 + 1];
+					dst[x * 3 + 2] = bytes[x * 3 + 0];
+				}
+			} else {
+				std::copy(bytes.begin(), bytes.end(), dst);
+			}
+		}
+	});
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+/**********************************************************************
+ * Turns the floating point frame into 8-bit pixels for saving
+ **********************************************************************/
+#include "raycast.h"
+
+struct PostSettings {
+	bool normalize;	// scale so the brightest channel is 1, +h
+	float exposure;	// scale applied after normalizing, +e<n>
+	bool tonemap;	// Reinhard tone mapping instead of clipping at 1, +t
+	float gamma;	// 1 keeps the values linear, +y<n>
+};
+
+extern PostSettings post_settings;
+
+// Develops the frame (or another image) into out, one row of 3 byte
+// pixels every stride bytes. bgr swaps red and blue, flip puts the top row
+// of the image first (the frame keeps the bottom row first).
+void develop_frame(const PostSettings &settings, unsigned char *out, int stride, bool bgr, bool flip,
+	const ImageBuffer &image = frame);
+
+// The largest channel value in the frame
+float frame_max(const ImageBuffer &image = frame);
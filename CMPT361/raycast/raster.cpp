@@ -0,0 +1,194 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "raster.h"
+#include "raycast.h"
+#include "trace.h"
+#include "model.h"
+#include "pool.h"
+
+VisSample vis_buffer[WIN_HEIGHT][WIN_WIDTH];
+
+//
+// Projects p onto the image plane, returning it in pixel coordinates.
+// Points that are not past the image plane can't be projected.
+//
+static bool project(const Vector &p, float &px, float &py) {
+	Vector d = {p.x - camera.eye.x, p.y - camera.eye.y, p.z - camera.eye.z};
+	float dz = dot(d, camera.forward);
+	if (dz < camera.distance + 0.0001) {
+		return false;
+	}
+	float s = camera.distance / dz;
+	float x = dot(d, camera.right) * s;
+	float y = dot(d, camera.up) * s;
+	px = (x + 0.5 * camera.width) / (camera.width / win_width) - 0.5;
+	py = (y + 0.5 * camera.height) / (camera.height / win_height) - 0.5;
+	return true;
+}
+
+// Rows [y0, y1) of the visibility buffer
+struct Band {
+	int y0;
+	int y1;
+};
+
+//
+// Finds the pixels of the band that the box covers. Returns false if the
+// box can't be projected, in which case the whole band is returned.
+//
+static bool screen_bounds(const Vector &bbmin, const Vector &bbmax, const Band &band,
+		int &x0, int &y0, int &x1, int &y1) {
+	x0 = 0;
+	y0 = band.y0;
+	x1 = win_width - 1;
+	y1 = band.y1 - 1;
+
+	float minx = 0, miny = 0, maxx = 0, maxy = 0;
+	for (int c = 0; c < 8; ++c) {
+		Vector corner;
+		corner.x = (c & 1) ? bbmax.x : bbmin.x;
+		corner.y = (c & 2) ? bbmax.y : bbmin.y;
+		corner.z = (c & 4) ? bbmax.z : bbmin.z;
+		float px, py;
+		if (!project(corner, px, py)) {
+			return false;
+		}
+		if (c == 0 || px < minx) minx = px;
+		if (c == 0 || px > maxx) maxx = px;
+		if (c == 0 || py < miny) miny = py;
+		if (c == 0 || py > maxy) maxy = py;
+	}
+	x0 = std::max(x0, (int)ceilf(minx));
+	x1 = std::min(x1, (int)floorf(maxx));
+	y0 = std::max(y0, (int)ceilf(miny));
+	y1 = std::min(y1, (int)floorf(maxy));
+	return true;
+}
+
+static void write_sample(int i, int j, int object, int face, float depth) {
+	VisSample &vis = vis_buffer[i][j];
+	if (depth > 0.0001 && depth < vis.depth) {
+		vis.object = object;
+		vis.face = face;
+		vis.depth = depth;
+	}
+}
+
+//
+// Casts the ray of every pixel in the rectangle against the object. Used
+// for the analytic objects and for anything crossing the image plane.
+//
+static void cast_object(const Object *o, int object, int x0, int y0, int x1, int y1) {
+	IntersectionInfo info;
+	for (int i = y0; i <= y1; ++i) {
+		for (int j = x0; j <= x1; ++j) {
+			Point p = pixel_pos(i, j);
+			Vector ray = normalize(get_vec(camera.eye, p));
+			float t = o->intersect(p, ray, info);
+			if (t != -1) {
+				write_sample(i, j, object, info.vertex, t);
+			}
+		}
+	}
+}
+
+static float edge(float ax, float ay, float bx, float by, float px, float py) {
+	return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+//
+// Scan converts the faces of a model that is entirely past the image plane
+//
+static void raster_model(const Model *m, int object, const Band &band) {
+	int size = m->numFaces();
+	for (int f = 0; f < size; ++f) {
+		Vector v[3];
+		m->getTriangle(f, v[0], v[1], v[2]);
+
+		float px[3], py[3];
+		for (int k = 0; k < 3; ++k) {
+			project(v[k], px[k], py[k]);
+		}
+		int x0 = std::max(0, (int)ceilf(std::min(std::min(px[0], px[1]), px[2])));
+		int x1 = std::min(win_width - 1, (int)floorf(std::max(std::max(px[0], px[1]), px[2])));
+		int y0 = std::max(band.y0, (int)ceilf(std::min(std::min(py[0], py[1]), py[2])));
+		int y1 = std::min(band.y1 - 1, (int)floorf(std::max(std::max(py[0], py[1]), py[2])));
+		if (x0 > x1 || y0 > y1) {
+			continue;
+		}
+
+		float area = edge(px[0], py[0], px[1], py[1], px[2], py[2]);
+		if (area == 0) {
+			continue;
+		}
+		Vector n = cross(v[1] - v[0], v[2] - v[0]);
+
+		for (int i = y0; i <= y1; ++i) {
+			for (int j = x0; j <= x1; ++j) {
+				float w0 = edge(px[1], py[1], px[2], py[2], j, i);
+				float w1 = edge(px[2], py[2], px[0], py[0], j, i);
+				float w2 = edge(px[0], py[0], px[1], py[1], j, i);
+				// accept either winding, and pixels on shared edges
+				if (area > 0 ? (w0 < 0 || w1 < 0 || w2 < 0) : (w0 > 0 || w1 > 0 || w2 > 0)) {
+					continue;
+				}
+
+				// the depth is where the pixel's ray meets the face plane
+				Point p = pixel_pos(i, j);
+				Vector ray = normalize(get_vec(camera.eye, p));
+				float denom = dot(n, ray);
+				if (fabs(denom) < 0.000001f) {
+					continue;
+				}
+				float t = dot(n, v[0] - Vector(p.x, p.y, p.z)) / denom;
+				write_sample(i, j, object, f, t);
+			}
+		}
+	}
+}
+
+static void raster_band(Band band) {
+	for (int i = band.y0; i < band.y1; ++i) {
+		for (int j = 0; j < win_width; ++j) {
+			vis_buffer[i][j].object = -1;
+			vis_buffer[i][j].face = 0;
+			vis_buffer[i][j].depth = cuttoff;
+		}
+	}
+
+	for (unsigned int k = 0; k < scene.size(); ++k) {
+		const Object *o = scene[k];
+		Vector bbmin, bbmax;
+		o->getBounds(bbmin, bbmax);
+		int x0, y0, x1, y1;
+		bool projected = screen_bounds(bbmin, bbmax, band, x0, y0, x1, y1);
+		if (x0 > x1 || y0 > y1) {
+			continue;
+		}
+		const Model *m = dynamic_cast<const Model *>(o);
+		if (m != nullptr && projected) {
+			// the face indices are only final once the BVH is built
+			m->prepare();
+			raster_model(m, k, band);
+		} else {
+			cast_object(o, k, x0, y0, x1, y1);
+		}
+	}
+}
+
+/*********************************************************************
+ * Fills vis_buffer with the closest object along the ray through the
+ * centre of every pixel. Each render thread rasterizes the whole scene
+ * into its own band of rows.
+ *********************************************************************/
+void rasterize_scene() {
+	int count = render_pool().size();
+	render_pool().parallel_for(count, [count](int k) {
+		Band band;
+		band.y0 = win_height * k / count;
+		band.y1 = win_height * (k + 1) / count;
+		raster_band(band);
+	});
+}
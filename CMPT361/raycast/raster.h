@@ -0,0 +1,17 @@
+#pragma once
+
+/**********************************************************************
+ * Primary visibility found by rasterizing the scene instead of casting
+ * the first ray of every pixel
+ **********************************************************************/
+#include "global.h"
+
+struct VisSample {
+	int object;	// index into scene, -1 for the background
+	int face;	// the face hit on models
+	float depth;	// distance along the ray through the pixel centre
+};
+
+extern VisSample vis_buffer[WIN_HEIGHT][WIN_WIDTH];
+
+void rasterize_scene();
@@ -19,14 +19,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <vector>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <memory>
 
 #include "raycast.h"
 #include "trace.h"
+#include "render.h"
 #include "global.h"
 #include "sphere.h"
 #include "image_util.h"
+#include "postprocess.h"
+#include "pool.h"
 #include "scene.h"
 #include "model.h"
+#include "checkpoint.h"
 
 //
 // Global variables
@@ -46,27 +54,21 @@ float frame[WIN_HEIGHT][WIN_WIDTH][3];
 // This gets displayed in glut window via texture mapping,
 // you can also save a copy as bitmap by pressing 's'
 
-float image_width = IMAGE_WIDTH;
-float image_height = (float(WIN_HEIGHT) / float(WIN_WIDTH)) * IMAGE_WIDTH;
-
 // some colors
 RGB_float background_clr; // background color
 RGB_float null_clr = {0.0, 0.0, 0.0};   // NULL color
 
 //
-// these view parameters should be fixed
+// these view parameters should be fixed, unless a batch of views is
+// rendered with +w
 //
-Point eye_pos = {0.0, 0.0, 0.0};  // eye position
-float image_plane = -1.5;           // image plane position
+Camera camera = look_at({0, 0, 0}, {0, 0, -1}, vec3(0, 1, 0));
 
 // list of spheres in the scene
 std::vector<Object *> scene;
 
-// light 1 position and color
-Point light1;
-float light1_ambient[3];
-float light1_diffuse[3];
-float light1_specular[3];
+// lights in the scene
+std::vector<Light> lights;
 
 // global ambient term
 float global_ambient[3];
@@ -89,6 +91,23 @@ int check_on = 0;
 int save_on = 0;
 int reflect_on = 0;
 int stochdiff_on = 0;
+// rays per stochastic diffuse bounce, +f<n> to change it
+int stoch_rays = STOCH_RAYS;
+int compact_on = 0;
+int vis_on = 0;
+int gbuffer_on = 0;
+int lazy_build_on = 0;
+int progressive_on = 0;
+int denoise_on = 0;
+int deterministic_on = 0;
+int lod_on = 0;
+int lod_levels = 0;
+int heatmap_on = 0;
+int schedule_on = 0;
+int fast_math_on = 0;
+int resume_on = 0;
+uint32_t render_key = 0;
+const char *output_name = "scene.bmp";
 
 
 // OpenGL
@@ -184,7 +203,30 @@ void display( void )
 	glutSwapBuffers();
 }
 
-void cleanup_threads();
+/*********************************************************
+ * Moves the first light or changes the decay and shades the
+ * image again. Only works with +g once rendering is done.
+ *********************************************************/
+void tweak_lighting(unsigned char key)
+{
+	if (!gbuffer_on || !render_done() || lights.empty()) {
+		printf("Re-shading needs +g and a finished render\n");
+		return;
+	}
+	Point &pos = lights[0].pos;
+	switch (key) {
+	case 'j': pos.x -= 0.5; break;
+	case 'l': pos.x += 0.5; break;
+	case 'k': pos.y -= 0.5; break;
+	case 'i': pos.y += 0.5; break;
+	case 'o': pos.z -= 0.5; break;
+	case 'u': pos.z += 0.5; break;
+	case '[': decay_b *= 0.8; break;
+	case ']': decay_b *= 1.25; break;
+	}
+	printf("light (%.1f, %.1f, %.1f) decay_b %.3f\n", pos.x, pos.y, pos.z, decay_b);
+	reshade();
+}
 
 /*********************************************************
  * This function handles keypresses
@@ -210,6 +252,25 @@ void keyboard(unsigned char key, int x, int y)
 	}
 }
 
+/*********************************************************
+ * The keys of keyboard, and
+ *
+ *   i j k l u o - move the light and re-shade
+ *   [ ] - change the light decay and re-shade
+ *********************************************************/
+void handle_key(unsigned char key, int x, int y)
+{
+	switch (key) {
+	case 'i':case 'j':case 'k':case 'l':case 'u':case 'o':case '[':case ']':
+		tweak_lighting(key);
+		glutPostRedisplay();
+		break;
+	default:
+		keyboard(key, x, y);
+		break;
+	}
+}
+
 int timeElapsed = 0;
 int timeSinceDisplay = 0;
 void idle(void) {
@@ -232,17 +293,115 @@ void idle(void) {
 
 //----------------------------------------------------------------------------
 
+// A camera of a +w batch
+struct View {
+	Point eye;
+	Point at;
+	Vector up;
+};
+
+//
+// Reads one view per line: the eye, the point it looks at and optionally
+// the up direction (y by default). Blank lines and lines starting with #
+// are skipped.
+//
+static bool read_views(const char *fname, std::vector<View> &views) {
+	FILE *fp = fopen(fname, "r");
+	if (!fp) {
+		printf("Unable to open file '%s'\n", fname);
+		return false;
+	}
+	char line[256];
+	int number = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		number++;
+		View v;
+		v.up = vec3(0, 1, 0);
+		char first = ' ';
+		if (sscanf(line, " %c", &first) != 1 || first == '#') {
+			continue;
+		}
+		int n = sscanf(line, "%f %f %f %f %f %f %f %f %f", &v.eye.x, &v.eye.y, &v.eye.z,
+			&v.at.x, &v.at.y, &v.at.z, &v.up.x, &v.up.y, &v.up.z);
+		if (n != 6 && n != 9) {
+			printf("%s:%d: expected eye, look at and up\n", fname, number);
+			fclose(fp);
+			return false;
+		}
+		views.push_back(v);
+	}
+	fclose(fp);
+	return true;
+}
+
+/*********************************************************************
+ * Renders every view into output_name numbered from 0, e.g.
+ * scene_000.bmp. The scene is set up and its BVHs built once, before the
+ * first frame.
+ *
+ * The views are all submitted to the pool at once as renders of their
+ * own, so the threads go straight from the last tiles of one view to the
+ * next. The extras that only work on frame (+v, +g, +i, +d and +k)
+ * render one view at a time with ray_trace instead.
+ *********************************************************************/
+static int render_views(const std::vector<View> &views) {
+	const char *base = output_name;
+	bool one_at_a_time = vis_on || gbuffer_on || progressive_on || denoise_on || heatmap_on;
+	auto start = std::chrono::steady_clock::now();
+
+	Scene batch;
+	RenderSettings settings = global_settings();
+	std::vector<std::unique_ptr<Framebuffer>> images;
+	std::vector<std::shared_future<void>> done;
+	if (!one_at_a_time) {
+		global_scene(batch);
+		prepare_scene(batch, !lazy_build_on);
+		for (const View &v : views) {
+			images.emplace_back(new Framebuffer(win_width, win_height));
+			done.push_back(render(batch, look_at(v.eye, v.at, v.up), settings, *images.back()));
+		}
+	}
+
+	for (unsigned int k = 0; k < views.size(); ++k) {
+		if (one_at_a_time) {
+			camera = look_at(views[k].eye, views[k].at, views[k].up);
+			ray_trace().wait();
+		} else {
+			done[k].wait();
+			const std::vector<float> &pixels = images[k]->pixels;
+			std::copy(pixels.begin(), pixels.end(), &frame[0][0][0]);
+			images[k].reset();
+		}
+		auto frame_end = std::chrono::steady_clock::now();
+
+		char number[16];
+		sprintf(number, "_%03d", k);
+		std::string name = add_to_name(base, number);
+		output_name = name.c_str();
+		save_image();
+		printf("View %d done after %.1f ms\n", k,
+			std::chrono::duration<float, std::milli>(frame_end - start).count());
+	}
+	output_name = base;
+	auto end = std::chrono::steady_clock::now();
+	printf("%d views in %.1f s\n", (int)views.size(),
+		std::chrono::duration<float>(end - start).count());
+	cleanup_threads();
+	return 0;
+}
+
 int main( int argc, char **argv )
 {
 	// Parse the arguments
 	if (argc < 3) {
 		printf("Missing arguments ... use:\n");
-		printf("./raycast [-u | -d] step_max <options>\n");
+		printf("./raycast [-u | -d | -c | -m] step_max <options>\n");
 		return -1;
 	}
 
 
 	step_max = atoi(argv[2]); // maximum level of recursions
+	const char *views_name = nullptr;
 
 	// Optional arguments
 	for(int i = 3; i < argc; i++)
@@ -253,17 +412,62 @@ int main( int argc, char **argv )
 		if (strcmp(argv[i], "+c") == 0)	check_on = 1;
 		if (strcmp(argv[i], "+l") == 0)	reflect_on = 1;
 		if (strcmp(argv[i], "+n") == 0)	save_on = 1;
-		if (strcmp(argv[i], "+f") == 0)	stochdiff_on = 1;
+		if (strncmp(argv[i], "+f", 2) == 0) {
+			stochdiff_on = 1;
+			if (argv[i][2] != '\0') stoch_rays = std::max(1, atoi(argv[i] + 2));
+		}
+		if (strcmp(argv[i], "+q") == 0)	compact_on = 1;
+		if (strcmp(argv[i], "+v") == 0)	vis_on = 1;
+		if (strcmp(argv[i], "+g") == 0)	gbuffer_on = 1;
+		if (strcmp(argv[i], "+z") == 0)	lazy_build_on = 1;
+		if (strcmp(argv[i], "+i") == 0)	progressive_on = 1;
+		if (strcmp(argv[i], "+d") == 0)	denoise_on = 1;
+		if (strcmp(argv[i], "+x") == 0)	deterministic_on = 1;
+		if (strcmp(argv[i], "+k") == 0)	heatmap_on = 1;
+		if (strcmp(argv[i], "+b") == 0)	schedule_on = 1;
+		if (strcmp(argv[i], "+m") == 0)	fast_math_on = 1;
+		if (strcmp(argv[i], "+u") == 0)	resume_on = 1;
+		if (strncmp(argv[i], "+a", 2) == 0) {
+			lod_on = 1;
+			lod_levels = atoi(argv[i] + 2);
+		}
+		if (strncmp(argv[i], "+j", 2) == 0)	set_render_threads(atoi(argv[i] + 2));
+		if (strcmp(argv[i], "+h") == 0)	post_settings.normalize = true;
+		if (strcmp(argv[i], "+t") == 0)	post_settings.tonemap = true;
+		if (strncmp(argv[i], "+e", 2) == 0)	post_settings.exposure = atof(argv[i] + 2);
+		if (strncmp(argv[i], "+y", 2) == 0)	post_settings.gamma = atof(argv[i] + 2);
+		if (strcmp(argv[i], "+w") == 0 && i + 1 < argc) {
+			views_name = argv[++i];
+		} else if (strncmp(argv[i], "+w", 2) == 0) {
+			views_name = argv[i] + 2;
+		}
+		if (strcmp(argv[i], "+o") == 0 && i + 1 < argc) {
+			output_name = argv[++i];
+		} else if (strncmp(argv[i], "+o", 2) == 0) {
+			output_name = argv[i] + 2;
+		}
 	}
 
 	if (strcmp(argv[1], "-u") == 0) {  // user defined scene
 		set_up_user_scene();
 	}else if (strcmp(argv[1], "-c") == 0) {  // user defined scene
 		set_up_chess_scene();
+	}else if (strcmp(argv[1], "-m") == 0) {  // many lights
+		set_up_many_lights_scene();
+	}else if (strcmp(argv[1], "-a") == 0) {  // area lights
+		set_up_area_lights_scene();
 	} else { // default scene
 		set_up_default_scene();
 	}
 
+	std::vector<View> views;
+	if (views_name != nullptr && !read_views(views_name, views)) {
+		return -1;
+	}
+	if (!views.empty()) {
+		return render_views(views);
+	}
+
 	//
 	// ray trace the scene now
 	//
@@ -271,10 +475,14 @@ int main( int argc, char **argv )
 	// happy to carry no parameters
 	//
 	printf("Rendering scene using my fantastic ray tracer ...\n");
-	ray_trace();
+	render_key = checkpoint_key(argc, argv);
+	std::shared_future<void> frame_done = ray_trace(true);
 
 	if (save_on) {
+		frame_done.wait();
+		// saving develops the frame on the pool, so it goes first
 		save_image();
+		cleanup_threads();
 		return 0;
 	}
 	// we want to make sure that intensity values are normalized
@@ -289,7 +497,7 @@ int main( int argc, char **argv )
 	init();
 
 	glutDisplayFunc( display );
-	glutKeyboardFunc( keyboard );
+	glutKeyboardFunc( handle_key );
 	glutIdleFunc(idle);
 	glutMainLoop();
 	return 0;
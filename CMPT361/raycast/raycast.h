@@ -2,7 +2,10 @@
 
 #include <vector>
 #include <mutex>
+#include <cstdint>
 #include "sphere.h"
+#include "light.h"
+#include "render.h"
 #include "global.h"
 
 extern std::vector<Object *> scene;
@@ -14,26 +17,41 @@ extern int reflect_on;
 extern int check_on;
 extern int step_max;
 extern int stochdiff_on;
+extern int stoch_rays;
+extern int compact_on;
+extern int vis_on;
+extern int gbuffer_on;
+extern int lazy_build_on;
+extern int progressive_on;
+extern int denoise_on;
+extern int deterministic_on;
+extern int lod_on;
+// levels +a<n> generates by simplifying, 0 to use the ones in the files
+extern int lod_levels;
+extern int heatmap_on;
+extern int schedule_on;
+extern int fast_math_on;
+extern int resume_on;
+// checkpoint_key of the arguments, so +u only resumes the same render
+extern uint32_t render_key;
+// file that +n and the s key save to
+extern const char *output_name;
 
 extern int win_width;
 extern int win_height;
 
-extern std::mutex frame_mutex;
-extern float frame[WIN_HEIGHT][WIN_WIDTH][3];
+// an image laid out like the frame, bottom row first
+typedef float ImageBuffer[WIN_HEIGHT][WIN_WIDTH][3];
 
-extern float image_width;
-extern float image_height;
+extern std::mutex frame_mutex;
+extern ImageBuffer frame;
 
 extern RGB_float background_clr;
 extern RGB_float null_clr;
 
-extern Point eye_pos;
-extern float image_plane;
+extern Camera camera;
 
-extern Point light1;
-extern float light1_ambient[3];
-extern float light1_diffuse[3];
-extern float light1_specular[3];
+extern std::vector<Light> lights;
 
 extern float global_ambient[3];
 
@@ -0,0 +1,82 @@
+#include <atomic>
+
+#include "render.h"
+#include "raycast.h"
+#include "trace.h"
+#include "model.h"
+#include "pool.h"
+
+/*********************************************************************
+ * Builds the BVH of every model that doesn't have one yet. Each model
+ * is a job, and big models split their build into more jobs.
+ *********************************************************************/
+static void build_acceleration(const std::vector<Object *> &objects) {
+	std::atomic<int> pending(0);
+	for (auto *o : objects) {
+		const Model *m = dynamic_cast<const Model *>(o);
+		if (m != nullptr) {
+			pending++;
+			render_pool().queue_job([m, &pending] {
+				m->prepare();
+				pending--;
+			});
+		}
+	}
+	render_pool().wait_jobs(pending);
+}
+
+void prepare_scene(Scene &scene, bool build) {
+	if (build) {
+		build_acceleration(scene.objects);
+	}
+	build_light_tree(scene);
+}
+
+Camera look_at(const Point &eye, const Point &at, const Vector &up) {
+	Camera c;
+	c.eye = eye;
+	c.forward = normalize(get_vec(eye, at));
+	c.right = normalize(cross(c.forward, up));
+	c.up = cross(c.right, c.forward);
+	c.distance = 1.5;
+	c.width = IMAGE_WIDTH;
+	c.height = (float(WIN_HEIGHT) / float(WIN_WIDTH)) * IMAGE_WIDTH;
+	return c;
+}
+
+Point camera_pixel(const Camera &camera, int width, int height, float i, float j) {
+	float x_grid_size = camera.width / float(width);
+	float y_grid_size = camera.height / float(height);
+	float x = -0.5 * camera.width + (j + 0.5) * x_grid_size;
+	float y = -0.5 * camera.height + (i + 0.5) * y_grid_size;
+	Vector v = camera.forward * camera.distance + camera.right * x + camera.up * y;
+	return get_point(camera.eye, v);
+}
+
+void global_scene(Scene &s) {
+	s.objects = scene;
+	s.lights = lights;
+	for (int i = 0; i < 3; ++i) {
+		s.global_ambient[i] = global_ambient[i];
+	}
+	s.background = background_clr;
+	s.decay_a = decay_a;
+	s.decay_b = decay_b;
+	s.decay_c = decay_c;
+}
+
+RenderSettings global_settings() {
+	RenderSettings s;
+	s.step_max = step_max;
+	s.shadow_on = shadow_on;
+	s.reflect_on = reflect_on;
+	s.refract_on = refract_on;
+	s.antialias_on = antialias_on;
+	s.stochdiff_on = stochdiff_on;
+	s.stoch_rays = stoch_rays;
+	s.deterministic_on = deterministic_on;
+	s.schedule_on = schedule_on;
+	s.fast_math_on = fast_math_on;
+	s.cutoff = cuttoff;
+	return s;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+/**********************************************************************
+ * Everything a render reads, as objects instead of globals, so that a
+ * process can have several renders of different scenes, cameras and
+ * settings in flight on the render pool at once. The globals of
+ * raycast.h describe the scene and flags of the command line, and
+ * ray_trace() renders them into frame through the same code.
+ **********************************************************************/
+#include <future>
+#include <vector>
+#include "sphere.h"
+#include "light.h"
+
+struct Scene {
+	// not owned, and shared with any other scene that has them
+	std::vector<Object *> objects;
+	std::vector<Light> lights;
+	float global_ambient[3];
+	RGB_float background;
+	// light decay parameters
+	float decay_a;
+	float decay_b;
+	float decay_c;
+
+	// filled in by prepare_scene
+	std::vector<LightNode> light_tree;
+	float light_ambient[3];	// summed ambient term of all the lights
+};
+
+// The image plane is distance in front of the eye along forward, width
+// by height, with its x and y along right and up
+struct Camera {
+	Point eye;
+	Vector forward;
+	Vector right;
+	Vector up;
+	float distance;
+	float width;
+	float height;
+};
+
+struct RenderSettings {
+	int step_max;
+	int shadow_on;
+	int reflect_on;
+	int refract_on;
+	int antialias_on;
+	int stochdiff_on;
+	int stoch_rays;
+	int deterministic_on;
+	int schedule_on;
+	int fast_math_on;	// approximate pow and 1 / sqrt in shading
+	float cutoff;	// hits further than this are ignored
+};
+
+// RGB floats, bottom row first like frame
+struct Framebuffer {
+	Framebuffer(int width, int height) :
+		width(width), height(height), pixels(width * height * 3, 0.0f) {}
+	float *pixel(int i, int j) { return &pixels[(i * width + j) * 3]; }
+
+	int width;
+	int height;
+	std::vector<float> pixels;
+};
+
+// Builds the light tree, and the BVH of every model that doesn't have
+// one yet when build is set. Needed once after the scene is filled in or
+// its lights change, before it is rendered.
+void prepare_scene(Scene &scene, bool build = true);
+
+// A camera at eye looking at at, keeping up as close to up as it can,
+// with the image plane of the default view
+Camera look_at(const Point &eye, const Point &at, const Vector &up);
+// The centre of pixel (i, j) of a width by height image on the image plane
+Point camera_pixel(const Camera &camera, int width, int height, float i, float j);
+
+/*********************************************************************
+ * Starts rendering the scene from the camera into fb on the render
+ * pool. The future is ready once every pixel is in fb. The scene (and
+ * its objects) and fb have to stay alive until then, and the scene
+ * can't be changed, but any number of renders can share it.
+ *
+ * The +g, +v, +i, +d and +k extras only work on the window frame, with
+ * ray_trace().
+ *********************************************************************/
+std::shared_future<void> render(const Scene &scene, const Camera &camera,
+	const RenderSettings &settings, Framebuffer &fb);
+
+// The scene, camera and settings given by the globals
+void global_scene(Scene &scene);
+RenderSettings global_settings();
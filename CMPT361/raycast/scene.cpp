@@ -2,11 +2,13 @@
 // this provide functions to set up the scene
 //
 #include <stdio.h>
+#include <chrono>
 
 #include "sphere.h"
 #include "plane.h"
 #include "raycast.h"
 #include "model.h"
+#include "asset.h"
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -20,12 +22,14 @@ void set_up_lights() {
 	global_ambient[0] = global_ambient[1] = global_ambient[2] = 0.2;
 
 	// setup light 1
-	light1.x = -2.0;
-	light1.y = 5.0;
-	light1.z = 1.0;
-	light1_ambient[0] = light1_ambient[1] = light1_ambient[2] = 0.1;
-	light1_diffuse[0] = light1_diffuse[1] = light1_diffuse[2] = 1.0;
-	light1_specular[0] = light1_specular[1] = light1_specular[2] = 1.0;
+	Light light1;
+	light1.pos.x = -2.0;
+	light1.pos.y = 5.0;
+	light1.pos.z = 1.0;
+	light1.ambient[0] = light1.ambient[1] = light1.ambient[2] = 0.1;
+	light1.diffuse[0] = light1.diffuse[1] = light1.diffuse[2] = 1.0;
+	light1.specular[0] = light1.specular[1] = light1.specular[2] = 1.0;
+	lights.push_back(light1);
 
 	// set up decay parameters
 	decay_a = 0.5;
@@ -140,13 +144,34 @@ void set_up_user_scene() {
 
 
 void set_up_chess_scene() {
-	set_up_lights();
+	auto start = std::chrono::steady_clock::now();
+	// the pieces load on the render threads while the rest is set up
+	std::vector<std::shared_future<Model *>> pieces;
 	for (int j = 0; j < 5; ++j) {
 		for (int i = 0; i < 5; ++i) {
-			scene.push_back(new Model("chess_pieces/chess_hires.smf", {(i*-0.5f)+1, -3, -2.5f-(j*0.5f)}));
+			pieces.push_back(load_model("chess_pieces/chess_hires.smf",
+				{(i*-0.5f)+1, -3, -2.5f-(j*0.5f)}, compact_on, [](Model *m) {
+					if (lod_levels > 0) {
+						m->addLODs(simplified_lods("chess_pieces/chess_hires.smf", lod_levels));
+					} else if (lod_on) {
+						m->addLOD("chess_pieces/chess_piece.smf");
+					}
+				}));
 		}
 	}
 
+	set_up_lights();
+	wait_assets();
+	// vertices, faces and normals, so +q can be compared with without
+	size_t bytes = 0;
+	for (auto &piece : pieces) {
+		scene.push_back(piece.get());
+		bytes += piece.get()->memoryUsage();
+	}
+	auto end = std::chrono::steady_clock::now();
+	printf("Loaded %d models (%d KB of meshes) in %.1f ms\n", (int)pieces.size(),
+		(int)(bytes / 1024), std::chrono::duration<float, std::milli>(end - start).count());
+
 
 	float chess_ambient[] = {0, 0.0, 0};
 	float chess_diffuse[] = {1, 1, 1};
@@ -158,3 +183,67 @@ void set_up_chess_scene() {
 					chess_specular, chess_shineness, chess_reflectance,
 					{-300, 0, -300}, {300, 0, 300}, {0,1,0}, {0,-3,0}));
 }
+
+/***************************************
+ * The default spheres lit by a grid of small coloured lights
+ ***************************************/
+void set_up_many_lights_scene() {
+	set_up_default_scene();
+	lights.clear();
+
+	const int grid = 24;
+	for (int j = 0; j < grid; ++j) {
+		for (int i = 0; i < grid; ++i) {
+			Light l;
+			l.pos.x = -6 + 12.f * i / (grid - 1);
+			l.pos.y = 3 + (i + j) % 3;
+			l.pos.z = 2 - 10.f * j / (grid - 1);
+			l.ambient[0] = l.ambient[1] = l.ambient[2] = 0.1 / (grid * grid);
+			// white lights tinted red, green or blue
+			float c[3];
+			c[0] = c[1] = c[2] = 1.5 / (grid * grid);
+			c[(i + j) % 3] += 1.5 / (grid * grid);
+			for (int k = 0; k < 3; ++k) {
+				l.diffuse[k] = c[k];
+				l.specular[k] = c[k];
+			}
+			lights.push_back(l);
+		}
+	}
+}
+
+/***************************************
+ * The default spheres lit by a rectangular light where the point light
+ * was and a small spherical one to the right, for soft shadows
+ ***************************************/
+void set_up_area_lights_scene() {
+	set_up_default_scene();
+	lights.clear();
+
+	Light rect;
+	rect.pos.x = -2.0;
+	rect.pos.y = 5.0;
+	rect.pos.z = 1.0;
+	rect.ambient[0] = rect.ambient[1] = rect.ambient[2] = 0.1;
+	rect.diffuse[0] = rect.diffuse[1] = rect.diffuse[2] = 1.0;
+	rect.specular[0] = rect.specular[1] = rect.specular[2] = 1.0;
+	rect.shape = LIGHT_RECT;
+	rect.edge_u = Vector(2, 0, 0);
+	rect.edge_v = Vector(0, 0, 2);
+	lights.push_back(rect);
+
+	Light ball;
+	ball.pos.x = 4.0;
+	ball.pos.y = 2.0;
+	ball.pos.z = -1.0;
+	ball.ambient[0] = ball.ambient[1] = ball.ambient[2] = 0.0;
+	ball.diffuse[0] = 0.6;
+	ball.diffuse[1] = 0.5;
+	ball.diffuse[2] = 0.3;
+	for (int i = 0; i < 3; ++i) {
+		ball.specular[i] = ball.diffuse[i];
+	}
+	ball.shape = LIGHT_SPHERE;
+	ball.radius = 0.6;
+	lights.push_back(ball);
+}
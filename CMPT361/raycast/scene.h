@@ -3,3 +3,5 @@
 void set_up_default_scene();
 void set_up_user_scene();
 void set_up_chess_scene();
+void set_up_many_lights_scene();
+void set_up_area_lights_scene();
@@ -0,0 +1,379 @@
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <iterator>
+#include <algorithm>
+
+#include "simplify.h"
+
+// How much more moving off a boundary edge costs than moving off a face,
+// so that holes and open edges keep their shape
+#define BOUNDARY_WEIGHT 100.0
+// A collapse is refused when it turns the normal of a face by more than
+// about 80 degrees
+#define MIN_NORMAL_DOT 0.2f
+// simplify_levels stops when a level keeps more than the ratio plus this
+// fraction of the faces of the one before
+#define LOD_SLACK 0.5f
+
+//
+// Symmetric 4x4 matrix that sums the squared distances to a set of
+// planes: a[] holds the upper triangle row by row
+//
+struct Quadric {
+	double a[10];
+
+	Quadric() {
+		std::fill(a, a + 10, 0.0);
+	}
+
+	// plane nx + d = 0, scaled by weight
+	Quadric(const Vector &n, double d, double weight) {
+		double p[4] = {n.x, n.y, n.z, d};
+		int k = 0;
+		for (int i = 0; i < 4; ++i) {
+			for (int j = i; j < 4; ++j) {
+				a[k++] = p[i] * p[j] * weight;
+			}
+		}
+	}
+
+	void operator +=(const Quadric &q) {
+		for (int k = 0; k < 10; ++k) {
+			a[k] += q.a[k];
+		}
+	}
+
+	double error(const Vector &v) const {
+		double x = v.x, y = v.y, z = v.z;
+		return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x +
+			a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y +
+			a[7]*z*z + 2*a[8]*z + a[9];
+	}
+
+	// Finds the point with the smallest error, false when the matrix is
+	// close to singular (flat or straight neighbourhoods)
+	bool minimum(Vector &out) const {
+		double m00 = a[0], m01 = a[1], m02 = a[2];
+		double m11 = a[4], m12 = a[5], m22 = a[7];
+		double b0 = -a[3], b1 = -a[6], b2 = -a[8];
+		double c00 = m11 * m22 - m12 * m12;
+		double c01 = m02 * m12 - m01 * m22;
+		double c02 = m01 * m12 - m02 * m11;
+		double det = m00 * c00 + m01 * c01 + m02 * c02;
+		double scale = m00 * m11 * m22;
+		if (fabs(det) <= 1e-6 * fabs(scale) || det == 0) {
+			return false;
+		}
+		double c11 = m00 * m22 - m02 * m02;
+		double c12 = m01 * m02 - m00 * m12;
+		double c22 = m00 * m11 - m01 * m01;
+		out.x = (c00 * b0 + c01 * b1 + c02 * b2) / det;
+		out.y = (c01 * b0 + c11 * b1 + c12 * b2) / det;
+		out.z = (c02 * b0 + c12 * b1 + c22 * b2) / det;
+		return true;
+	}
+};
+
+struct Collapse {
+	double cost;
+	int u;
+	int v;
+	int stamp_u;
+	int stamp_v;
+	Vector pos;
+
+	// the cheapest collapse comes out of the queue first, ties broken by
+	// the vertices so the result doesn't depend on the heap
+	bool operator <(const Collapse &c) const {
+		if (cost != c.cost) {
+			return cost > c.cost;
+		}
+		return u != c.u ? u > c.u : v > c.v;
+	}
+};
+
+class Simplifier {
+public:
+	Simplifier(std::vector<Vector> &vertices, std::vector<Face> &faces) :
+		_pos(vertices), _faces(faces), _alive(faces.size(), true),
+		_quadrics(vertices.size()), _vfaces(vertices.size()),
+		_stamp(vertices.size(), 0), _live(faces.size()) {}
+
+	void run(int target);
+	// Drops the removed faces and unused vertices and updates the normals
+	void finish();
+
+private:
+	void addQuadrics();
+	void pushEdge(int u, int v);
+	bool allowed(int u, int v, const Vector &pos) const;
+	void collapse(int u, int v, const Vector &pos);
+	void neighbours(int u, std::vector<int> &out) const;
+	Vector normal(const Face &f) const;
+
+	std::vector<Vector> &_pos;
+	std::vector<Face> &_faces;
+	std::vector<bool> _alive;
+	std::vector<Quadric> _quadrics;
+	// faces around each vertex, including ones that have been removed
+	std::vector<std::vector<int>> _vfaces;
+	// bumped whenever a vertex changes, -1 once it is collapsed away
+	std::vector<int> _stamp;
+	std::priority_queue<Collapse> _queue;
+	int _live;
+};
+
+static inline int corner(const Face &f, int k) {
+	return k == 0 ? f.x : k == 1 ? f.y : f.z;
+}
+
+static inline void setCorner(Face &f, int k, int v) {
+	(k == 0 ? f.x : k == 1 ? f.y : f.z) = v;
+}
+
+Vector Simplifier::normal(const Face &f) const {
+	return cross(_pos[f.y] - _pos[f.x], _pos[f.z] - _pos[f.x]);
+}
+
+//
+// Each vertex starts with the planes of its faces, weighted by their
+// area. Edges with only one face also add a plane through the edge that
+// is perpendicular to the face.
+//
+void Simplifier::addQuadrics() {
+	std::unordered_map<uint64_t, int> edges;
+	for (unsigned int i = 0; i < _faces.size(); ++i) {
+		const Face &f = _faces[i];
+		Vector n = normal(f);
+		double area = length(n) / 2;
+		if (area > 0) {
+			n = normalize(n);
+			Quadric q(n, -dot(n, _pos[f.x]), area);
+			for (int k = 0; k < 3; ++k) {
+				_quadrics[corner(f, k)] += q;
+			}
+		}
+		for (int k = 0; k < 3; ++k) {
+			int a = corner(f, k);
+			int b = corner(f, (k + 1) % 3);
+			_vfaces[a].push_back(i);
+			edges[(uint64_t)std::min(a, b) << 32 | std::max(a, b)]++;
+		}
+	}
+
+	for (const Face &f : _faces) {
+		Vector n = normal(f);
+		if (length(n) == 0) {
+			continue;
+		}
+		n = normalize(n);
+		for (int k = 0; k < 3; ++k) {
+			int a = corner(f, k);
+			int b = corner(f, (k + 1) % 3);
+			if (edges[(uint64_t)std::min(a, b) << 32 | std::max(a, b)] != 1) {
+				continue;
+			}
+			Vector e = _pos[b] - _pos[a];
+			Vector side = normalize(cross(e, n));
+			Quadric q(side, -dot(side, _pos[a]), BOUNDARY_WEIGHT * dot(e, e));
+			_quadrics[a] += q;
+			_quadrics[b] += q;
+		}
+	}
+}
+
+void Simplifier::neighbours(int u, std::vector<int> &out) const {
+	out.clear();
+	for (int i : _vfaces[u]) {
+		if (!_alive[i]) {
+			continue;
+		}
+		for (int k = 0; k < 3; ++k) {
+			int w = corner(_faces[i], k);
+			if (w != u) {
+				out.push_back(w);
+			}
+		}
+	}
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+//
+// Queues the collapse of edge uv to the point with the smallest error,
+// or the better of its ends and middle when there is no single one
+//
+void Simplifier::pushEdge(int u, int v) {
+	if (u > v) {
+		std::swap(u, v);
+	}
+	Quadric q = _quadrics[u];
+	q += _quadrics[v];
+	Vector pos;
+	double cost;
+	if (q.minimum(pos)) {
+		cost = q.error(pos);
+	} else {
+		Vector candidates[3] = {_pos[u], _pos[v], (_pos[u] + _pos[v]) * 0.5f};
+		pos = candidates[0];
+		cost = q.error(pos);
+		for (int k = 1; k < 3; ++k) {
+			double c = q.error(candidates[k]);
+			if (c < cost) {
+				cost = c;
+				pos = candidates[k];
+			}
+		}
+	}
+	_queue.push({std::max(cost, 0.0), u, v, _stamp[u], _stamp[v], pos});
+}
+
+//
+// A collapse is only made when u and v share no more than the two
+// vertices of the faces on the edge, so the mesh stays a manifold, and
+// none of the faces that stay turns too far
+//
+bool Simplifier::allowed(int u, int v, const Vector &pos) const {
+	std::vector<int> nu, nv, common;
+	neighbours(u, nu);
+	neighbours(v, nv);
+	std::set_intersection(nu.begin(), nu.end(), nv.begin(), nv.end(), std::back_inserter(common));
+	if (common.size() > 2) {
+		return false;
+	}
+
+	for (int moved : {u, v}) {
+		for (int i : _vfaces[moved]) {
+			if (!_alive[i]) {
+				continue;
+			}
+			const Face &f = _faces[i];
+			bool hasU = f.x == u || f.y == u || f.z == u;
+			bool hasV = f.x == v || f.y == v || f.z == v;
+			if (hasU && hasV) {
+				continue;
+			}
+			Vector before = normal(f);
+			Vector p[3];
+			for (int k = 0; k < 3; ++k) {
+				int w = corner(f, k);
+				p[k] = w == moved ? pos : _pos[w];
+			}
+			Vector after = cross(p[1] - p[0], p[2] - p[0]);
+			float la = length(after);
+			float lb = length(before);
+			if (la == 0 || (lb > 0 && dot(before, after) < MIN_NORMAL_DOT * la * lb)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void Simplifier::collapse(int u, int v, const Vector &pos) {
+	_pos[u] = pos;
+	_quadrics[u] += _quadrics[v];
+	for (int i : _vfaces[v]) {
+		if (!_alive[i]) {
+			continue;
+		}
+		Face &f = _faces[i];
+		if (f.x == u || f.y == u || f.z == u) {
+			_alive[i] = false;
+			--_live;
+			continue;
+		}
+		for (int k = 0; k < 3; ++k) {
+			if (corner(f, k) == v) {
+				setCorner(f, k, u);
+			}
+		}
+		_vfaces[u].push_back(i);
+	}
+	std::vector<int>().swap(_vfaces[v]);
+	auto dead = [this](int i) { return !_alive[i]; };
+	_vfaces[u].erase(std::remove_if(_vfaces[u].begin(), _vfaces[u].end(), dead), _vfaces[u].end());
+	_stamp[u]++;
+	_stamp[v] = -1;
+
+	std::vector<int> around;
+	neighbours(u, around);
+	for (int w : around) {
+		pushEdge(u, w);
+	}
+}
+
+void Simplifier::run(int target) {
+	addQuadrics();
+	std::unordered_set<uint64_t> edges;
+	for (const Face &f : _faces) {
+		for (int k = 0; k < 3; ++k) {
+			int a = corner(f, k);
+			int b = corner(f, (k + 1) % 3);
+			if (edges.insert((uint64_t)std::min(a, b) << 32 | std::max(a, b)).second) {
+				pushEdge(a, b);
+			}
+		}
+	}
+
+	while (_live > target && !_queue.empty()) {
+		Collapse c = _queue.top();
+		_queue.pop();
+		if (_stamp[c.u] != c.stamp_u || _stamp[c.v] != c.stamp_v) {
+			continue;
+		}
+		if (!allowed(c.u, c.v, c.pos)) {
+			continue;
+		}
+		collapse(c.u, c.v, c.pos);
+	}
+}
+
+void Simplifier::finish() {
+	std::vector<int> remap(_pos.size(), -1);
+	std::vector<Vector> vertices;
+	std::vector<Face> faces;
+	for (unsigned int i = 0; i < _faces.size(); ++i) {
+		if (!_alive[i]) {
+			continue;
+		}
+		Face f = _faces[i];
+		for (int k = 0; k < 3; ++k) {
+			int &w = remap[corner(f, k)];
+			if (w == -1) {
+				w = vertices.size();
+				vertices.push_back(_pos[corner(f, k)]);
+			}
+			setCorner(f, k, w);
+		}
+		faces.push_back(f);
+	}
+	_pos.swap(vertices);
+	_faces.swap(faces);
+	for (Face &f : _faces) {
+		f.norm = normalize(normal(f));
+	}
+}
+
+void simplify_mesh(MeshData &mesh, int target) {
+	Simplifier simplifier(mesh.vertices, mesh.faces);
+	simplifier.run(target);
+	simplifier.finish();
+}
+
+std::vector<MeshData> simplify_levels(const MeshData &mesh, int levels, float ratio) {
+	std::vector<MeshData> lods;
+	MeshData level = mesh;
+	for (int k = 0; k < levels; ++k) {
+		size_t before = level.faces.size();
+		simplify_mesh(level, before * ratio);
+		// stop once no more edges can go, rather than repeat the last level
+		if (level.faces.empty() || level.faces.size() > before * (ratio + LOD_SLACK)) {
+			break;
+		}
+		lods.push_back(level);
+	}
+	return lods;
+}
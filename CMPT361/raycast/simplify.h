@@ -0,0 +1,19 @@
+#pragma once
+
+/**********************************************************************
+ * Mesh simplification by edge collapses ordered by the quadric error
+ * metric (Garland and Heckbert, "Surface Simplification Using Quadric
+ * Error Metrics", 1997). Used to make levels of detail for models that
+ * don't come with them.
+ **********************************************************************/
+#include <vector>
+#include "model.h"
+
+// Collapses the cheapest edges until the mesh has at most target faces,
+// or no edge is left that can go without folding the surface over. Unused
+// vertices are removed. The face normals are recomputed.
+void simplify_mesh(MeshData &mesh, int target);
+// levels coarser levels of detail of the mesh, each simplified to about
+// ratio times the faces of the one before. Fewer once a level can hardly
+// be simplified any further.
+std::vector<MeshData> simplify_levels(const MeshData &mesh, int levels, float ratio);
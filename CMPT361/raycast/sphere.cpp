@@ -88,3 +88,8 @@ Vector Sphere::getNormal(const IntersectionInfo &info) const {
 	rc = get_vec(center, info.pos);
 	return normalize(rc);
 }
+
+void Sphere::getBounds(Vector &min, Vector &max) const {
+	min = Vector(center.x - radius, center.y - radius, center.z - radius);
+	max = Vector(center.x + radius, center.y + radius, center.z + radius);
+}
@@ -5,11 +5,30 @@
  **********************************************************************/
 #include "vector.h"
 
+class Object;
+
+// The cone a ray stands for: its width at the ray origin and how much
+// that grows per unit of distance. Meshes pick their level of detail by
+// the width where the cone reaches them, except the one the ray leaves
+// from, which keeps the level it was hit at so the ray can't start
+// inside a finer version of it.
+struct RayCone {
+	float width;
+	float spread;
+	const Object *surface;
+	int lod;
+};
+
 class IntersectionInfo {
 public:
-	IntersectionInfo() : vertex(0) {}
+	IntersectionInfo() : vertex(0), lod(0), face_tests(0), cone({0, 0, nullptr, 0}) {}
 	Point pos;
 	int vertex;
+	int lod;	// level of detail of the mesh that was hit
+	int face_tests;	// triangles tested by models, added up for +k
+	// Set to the cone of the ray before intersecting, 0 for the finest
+	// detail. getClosestObject leaves the cone at the hit in it.
+	RayCone cone;
 };
 
 class Object {
@@ -29,6 +48,8 @@ public:
 	virtual float intersect(const Point &, const Vector &, IntersectionInfo &) const = 0;
 	virtual Vector getNormal(const IntersectionInfo &) const = 0;
 	virtual float getDiffuse(const Point &, int i) const { return mat_diffuse[i]; }
+	// axis aligned box containing everything the object can be hit at
+	virtual void getBounds(Vector &min, Vector &max) const = 0;
 
 protected:
 	float mat_diffuse[3];
@@ -39,6 +60,7 @@ public:
 	Sphere(Point, float, float [], float [], float [], float, float, int);
 	virtual float intersect(const Point &, const Vector &, IntersectionInfo &) const;
 	virtual Vector getNormal(const IntersectionInfo &) const;
+	virtual void getBounds(Vector &min, Vector &max) const;
 
 	int index;
 	Point center;
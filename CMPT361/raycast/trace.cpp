@@ -3,70 +3,366 @@
 #include <math.h>
 #include <cstdio>
 #include <thread>
-#include <queue>
+#include <functional>
 #include <mutex>
-#include <condition_variable>
 #include <random>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 
 #include "raycast.h"
+#include "render.h"
 #include "global.h"
 #include "sphere.h"
 #include "model.h"
+#include "trace.h"
+#include "raster.h"
+#include "pool.h"
+#include "denoise.h"
+#include "cost.h"
+#include "fastmath.h"
+#include "checkpoint.h"
 
 
 int cuttoff = 100000;
 
+// A block of pixels along with the objects that a primary ray through
+// the block can hit
+struct Tile {
+	int x0, y0;
+	int x1, y1;
+	std::vector<Object *> objects;
+	float cost;	// estimated render time, for schedule_on
+	bool done;	// loaded from a checkpoint by +u, so not traced
+};
+
+// The features a trace kernel is compiled for. Each combination has its
+// own instantiation of the functions below, so the tests of features
+// that are off fold away instead of being made for every ray.
+enum TraceFeature {
+	TRACE_SHADOW = 1,
+	TRACE_REFLECT = 2,
+	TRACE_REFRACT = 4,
+	TRACE_STOCHDIFF = 8,
+	TRACE_ANTIALIAS = 16,
+	TRACE_FASTMATH = 32,
+	TRACE_COSTS = 64,	// counting rays and tests for +k
+	TRACE_ALL = 127
+};
+
+struct RenderJob;
+
+// The entry points of the kernel for one set of features
+struct Kernel {
+	void (*tile)(const RenderJob &job, const Tile &t, int step, bool first);
+	float (*tile_cost)(const RenderJob &job, const Tile &t);
+	void (*reshade_rows)(const RenderJob &job, int y0, int y1);
+};
+
+// One frame being rendered, shared by its tiles. The tracing below only
+// reads the job, so any number of them can be in flight at once.
+struct RenderJob {
+	const Scene *scene;
+	Camera camera;
+	RenderSettings settings;
+	Kernel kernel;	// picked for the settings by submit_job
+	int width;
+	int height;
+	// where the pixels go, nullptr for frame
+	Framebuffer *fb;
+	// +g, +d, +v and +k, which only work on frame
+	bool gbuffer;
+	bool denoise;
+	bool vis;
+	bool heatmap;
+	std::vector<Tile> tiles;
+	// how long every tile took in every pass
+	std::vector<float> times;
+	// where finished tiles are saved, nullptr for none
+	std::unique_ptr<Checkpoint> checkpoint;
+	// passes of each tile still queued or running, as with +i a tile's
+	// passes can run at the same time on different threads
+	std::unique_ptr<std::atomic<int>[]> passes_left;
+};
+
 /////////////////////////////////////////////////////////////////////
 
-const Object *getClosestObject(const Point &pos, const Vector &ray, IntersectionInfo &end) {
+template <int F>
+const Object *getClosestObject(const Point &pos, const Vector &ray, IntersectionInfo &end,
+		const std::vector<Object *> &objects, float cutoff) {
 	float closest = -1;
 	bool notfound = true;
 	const Object *sph = nullptr;
 	IntersectionInfo info;
-	for (const auto *s : scene) {
+	RayCone cone = end.cone;
+	info.cone = cone;
+	for (const auto *s : objects) {
 		float val = s->intersect(pos, ray, info);
-		if (val != -1 && (notfound || val < closest) && val < cuttoff) {
+		if (val != -1 && (notfound || val < closest) && val < cutoff) {
 			notfound = false;
 			closest = val;
 			sph = s;
 			end = info;
 		}
 	}
+	end.cone.width = cone.width + cone.spread * std::max(closest, 0.0f);
+	if (F & TRACE_COSTS) {
+		ray_counters.object_tests += objects.size();
+		ray_counters.face_tests += info.face_tests;
+	}
 	return sph;
 }
 
+// Random numbers for light sampling and stochastic diffuse rays, one
+// generator per render thread
+thread_local std::default_random_engine sample_generator;
+
+// The sample being traced by this thread, and how many shading points it
+// has seeded so far
+struct SampleKey {
+	uint32_t pixel;
+	uint32_t sample;
+	uint32_t events;
+};
+thread_local SampleKey sample_key;
+
+static void begin_sample(const RenderJob &job, int i, int j, int sample) {
+	sample_key.pixel = i * job.width + j;
+	sample_key.sample = sample;
+	sample_key.events = 0;
+}
+
+static inline uint32_t mix_bits(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+//
+// Seed for the random numbers of one shading point. With +x it is a hash
+// of the pixel, the sample, the bounce and the order of the shading point
+// within the sample, so the image doesn't depend on which thread traced
+// what.
+//
+static uint32_t shading_seed(const RenderJob &job, int bounce) {
+	if (!job.settings.deterministic_on) {
+		return sample_generator();
+	}
+	uint32_t h = mix_bits(sample_key.pixel + 0x9e3779b9);
+	h = mix_bits(h ^ sample_key.sample);
+	h = mix_bits(h ^ bounce);
+	return mix_bits(h ^ sample_key.events++);
+}
+
+// Which lights were blocked at a shading point. Lets a re-shade skip the
+// shadow rays while the lights stay where they are.
+struct ShadowCache {
+	bool valid;
+	uint32_t occluded;
+	uint32_t penumbra;	// area lights that were partly blocked, traced again
+};
+
+// Everything needed to shade a primary hit again without tracing it
+struct GSample {
+	const Object *object;	// nullptr for the background
+	IntersectionInfo hit;
+	Vector ray;
+	ShadowCache shadow;
+	RGB_float noise;	// the stochastic diffuse part of the colour, for +d
+};
+
+std::vector<GSample> gbuffer;
+// the lights the cached shadows were computed for
+std::vector<Point> gbuffer_lights;
+int gbuffer_shadow_on;
+
+//
+// Normalizes v and returns the length it had, with fast_rsqrt under
+// TRACE_FASTMATH
+//
+template <int F>
+float make_unit(Vector &v) {
+	if (F & TRACE_FASTMATH) {
+		float d = dot(v, v);
+		float r = fast_rsqrt(d);
+		v = v * r;
+		return d * r;
+	}
+	float len = length(v);
+	v = normalize(v);
+	return len;
+}
+
 /*********************************************************************
- * Phong illumination - you need to implement this!
+ * Casts a shadow ray from q towards the point lp of a light
  *********************************************************************/
-RGB_float phong(const Point &q, Vector v, const Vector &norm, const Object *sph) {
-	float ip[3] = {0,0,0};
-	Vector lm = get_vec(q, light1);
-	float dist = length(lm);
-	lm = normalize(lm);
+template <int F>
+bool light_blocked(const RenderJob &job, const Point &lp, const Point &q, const Object *sph,
+		const RayCone &cone) {
+	Vector lm = get_vec(q, lp);
+	float dist = make_unit<F>(lm);
 	IntersectionInfo end;
-	bool indirect = false;
-	const Object *o = getClosestObject(q, lm, end);
+	end.cone = cone;
+	if (F & TRACE_COSTS) {
+		ray_counters.shadow_rays++;
+	}
+	const Object *o = getClosestObject<F>(q, lm, end, job.scene->objects, job.settings.cutoff);
 	// If shadows are off we still don't allow light to pass through to the
 	// backside of an object.
-	if (o != nullptr && (shadow_on || o == sph)) {
-		indirect = true;
-	}
-	Vector r = normalize(vec_reflect(lm, norm));
-	v = normalize(v);
+	return o != nullptr && ((F & TRACE_SHADOW) || o == sph) &&
+		length(get_vec(q, end.pos)) < dist;
+}
 
-	float decay = 1/(decay_a + decay_b * dist + decay_c * dist * dist);
+/*********************************************************************
+ * Adds the diffuse and specular contribution at q of the light from
+ * its point lp, scaled by weight. TRACE_FASTMATH approximates the pow
+ * and square roots.
+ *********************************************************************/
+template <int F>
+void add_light(const Scene &scene, float ip[3], const Light &light, const Point &lp, const Point &q,
+		const Vector &v, const Vector &norm, const Object *sph, float weight) {
+	Vector lm = get_vec(q, lp);
+	float dist = make_unit<F>(lm);
+	Vector r = vec_reflect(lm, norm);
+	make_unit<F>(r);
+
+	float decay = weight/(scene.decay_a + scene.decay_b * dist + scene.decay_c * dist * dist);
+	float rv = dot(r, v);
+	float spec = (F & TRACE_FASTMATH) ? fast_pow(rv, sph->mat_shineness) :
+		pow(rv, sph->mat_shineness);
 
 	for (int i = 0; i < 3; ++i) {
-		ip[i] += global_ambient[i] * sph->mat_ambient[i];
-		ip[i] += sph->mat_ambient[i] * light1_ambient[i];
+		float ds = 0;
+		ds += light.diffuse[i] * sph->getDiffuse(q, i) * dot(lm, norm);
+		ds += light.specular[i] * sph->mat_specular[i] * spec;
 
+		ip[i] += ds * decay;
+	}
+}
 
-		float ds = 0;
-		if (!indirect) {
-			ds += light1_diffuse[i] * sph->getDiffuse(q, i) * dot(lm, norm);
-			ds += light1_specular[i] * sph->mat_specular[i] * pow(dot(r, v), sph->mat_shineness);
+// How much of a light a shading point sees
+enum LightVisibility {
+	LIGHT_LIT,
+	LIGHT_BLOCKED,
+	LIGHT_PENUMBRA
+};
+
+/*********************************************************************
+ * Adds the light at q scaled by weight. A point light takes one shadow
+ * ray. An area light is shaded from AREA_SAMPLES by AREA_SAMPLES
+ * points, one in each cell of a grid over it. Their shadow rays are
+ * only cast if q is in a penumbra, which AREA_PROBES by AREA_PROBES
+ * probe rays tell by some being blocked and others not; when none or
+ * all of them are, q is taken to be fully shadowed or lit. Without
+ * trace the light is taken to be lit and no rays are cast, for a
+ * re-shade of a cached LIGHT_LIT.
+ *********************************************************************/
+template <int F>
+LightVisibility shade_light(const RenderJob &job, float ip[3], const Light &light, const Point &q,
+		const Vector &v, const Vector &norm, const Object *sph, const RayCone &cone,
+		std::default_random_engine &rng, float weight, bool trace) {
+	const Scene &scene = *job.scene;
+	if (light.shape == LIGHT_POINT) {
+		if (trace && light_blocked<F>(job, light.pos, q, sph, cone)) {
+			return LIGHT_BLOCKED;
+		}
+		add_light<F>(scene, ip, light, light.pos, q, v, norm, sph, weight);
+		return LIGHT_LIT;
+	}
+
+	std::uniform_real_distribution<float> distribution(0, 1);
+	const int probes = AREA_PROBES * AREA_PROBES;
+	int lit = probes;
+	if (trace) {
+		lit = 0;
+		for (int k = 0; k < probes; ++k) {
+			float u = (k % AREA_PROBES + distribution(rng)) / AREA_PROBES;
+			float w = (k / AREA_PROBES + distribution(rng)) / AREA_PROBES;
+			lit += !light_blocked<F>(job, light_point(light, q, u, w), q, sph, cone);
+		}
+		if (lit == 0) {
+			return LIGHT_BLOCKED;
+		}
+	}
+
+	const int samples = AREA_SAMPLES * AREA_SAMPLES;
+	for (int k = 0; k < samples; ++k) {
+		float u = (k % AREA_SAMPLES + distribution(rng)) / AREA_SAMPLES;
+		float w = (k / AREA_SAMPLES + distribution(rng)) / AREA_SAMPLES;
+		Point p = light_point(light, q, u, w);
+		if (lit == probes || !light_blocked<F>(job, p, q, sph, cone)) {
+			add_light<F>(scene, ip, light, p, q, v, norm, sph, weight / samples);
+		}
+	}
+	return lit == probes ? LIGHT_LIT : LIGHT_PENUMBRA;
+}
 
-			ip[i] += ds * decay;
+/*********************************************************************
+ * Phong illumination - you need to implement this!
+ *
+ * With more than LIGHT_SAMPLES lights only LIGHT_SAMPLES of them are
+ * evaluated, picked from the light tree by their estimated contribution.
+ * Otherwise the shadow rays are looked up in or saved to cache.
+ *********************************************************************/
+template <int F>
+RGB_float phong(const RenderJob &job, const Point &q, Vector v, const Vector &norm,
+		const Object *sph, const RayCone &cone, std::default_random_engine &rng,
+		ShadowCache *cache = nullptr) {
+	const Scene &scene = *job.scene;
+	const std::vector<Light> &lights = scene.lights;
+	float ip[3] = {0,0,0};
+	make_unit<F>(v);
+
+	for (int i = 0; i < 3; ++i) {
+		ip[i] += scene.global_ambient[i] * sph->mat_ambient[i];
+		ip[i] += sph->mat_ambient[i] * scene.light_ambient[i];
+	}
+
+	int count = lights.size();
+	if (count <= LIGHT_SAMPLES) {
+		bool cached = cache != nullptr && cache->valid;
+		if (cache != nullptr && !cached) {
+			cache->occluded = 0;
+			cache->penumbra = 0;
+		}
+		for (int k = 0; k < count; ++k) {
+			bool trace = true;
+			if (cached) {
+				if ((cache->occluded >> k) & 1) {
+					continue;
+				}
+				trace = (cache->penumbra >> k) & 1;
+			}
+			LightVisibility seen = shade_light<F>(job, ip, lights[k], q, v, norm, sph, cone,
+				rng, 1, trace);
+			if (cache != nullptr && !cached) {
+				if (seen == LIGHT_BLOCKED) {
+					cache->occluded |= 1u << k;
+				} else if (seen == LIGHT_PENUMBRA) {
+					cache->penumbra |= 1u << k;
+				}
+			}
+		}
+		if (cache != nullptr) {
+			cache->valid = true;
+		}
+	} else {
+		std::uniform_real_distribution<float> distribution(0, 1);
+		for (int k = 0; k < LIGHT_SAMPLES; ++k) {
+			// stratify the samples over the tree
+			float u = (k + distribution(rng)) / LIGHT_SAMPLES;
+			float pdf;
+			int l = sample_light(scene, q, norm, u, pdf);
+			if (l != -1) {
+				shade_light<F>(job, ip, lights[l], q, v, norm, sph, cone, rng,
+					1 / (pdf * LIGHT_SAMPLES), true);
+			}
 		}
 	}
 	RGB_float color = {ip[0], ip[1], ip[2]};
@@ -77,79 +373,235 @@ RGB_float phong(const Point &q, Vector v, const Vector &norm, const Object *sph)
  * This is the recursive ray tracer - you need to implement this!
  * You should decide what arguments to use.
  ************************************************************************/
-RGB_float recursive_ray_trace(Point &pos, Vector &ray, int num, bool inside=false) {
-	IntersectionInfo end;
-	const Object *s = getClosestObject(pos, ray, end);
-	if (s == nullptr) {
-		return background_clr;
-	}
+template <int F>
+RGB_float recursive_ray_trace(const RenderJob &job, Point &pos, Vector &ray, int num,
+		const RayCone &cone, bool inside, const std::vector<Object *> &objects,
+		GSample *g = nullptr);
 
+// How much wider the cone of a stochastic diffuse ray gets per unit of
+// distance, about the 10 degrees they are rotated by
+static const float STOCH_SPREAD = 0.18f;
+
+/************************************************************************
+ * Shades the hit of ray with s, tracing the secondary rays. Secondary
+ * rays that don't contribute to the colour are skipped. The hit is saved
+ * to g when it is given.
+ ************************************************************************/
+template <int F>
+RGB_float shade(const RenderJob &job, const Object *s, IntersectionInfo &end, Vector &ray,
+		int num, bool inside, GSample *g = nullptr) {
+	const RenderSettings &settings = job.settings;
+	const std::vector<Object *> &objects = job.scene->objects;
+	if (g != nullptr) {
+		g->object = s;
+		g->hit = end;
+		g->ray = ray;
+		g->noise = {0,0,0};
+	}
 	Vector norm = s->getNormal(end);
 	if (inside) {
 		norm *= -1;
 	}
-	RGB_float color = phong(end.pos, ray, norm, s);
-	if (num <= step_max) {
+	std::default_random_engine rng(shading_seed(job, num));
+	// the cone of the rays leaving the hit
+	RayCone cone = end.cone;
+	cone.surface = s;
+	cone.lod = end.lod;
+	RGB_float color = phong<F>(job, end.pos, ray, norm, s, cone, rng,
+		g != nullptr ? &g->shadow : nullptr);
+	if (num <= settings.step_max) {
 		Vector h;
 		RGB_float ref({0,0,0});
 		RGB_float ract({0,0,0});
-		if (!inside && reflect_on) {
+		float reflectWeight = s->reflectance;
+		float refractWeight = 0;
+		if ((F & TRACE_REFRACT) && s->transparency > 0) {
+			refractWeight = s->transparency;
+			reflectWeight = (1-refractWeight)*s->reflectance;
+		}
+
+		if (!inside && (F & TRACE_REFLECT) && reflectWeight != 0) {
 			h = vec_reflect(ray, norm);
-			ref = recursive_ray_trace(end.pos, h, num + 1);
+			ref = recursive_ray_trace<F>(job, end.pos, h, num + 1, cone, false, objects);
 		}
-		if (stochdiff_on) {
+		if ((F & TRACE_STOCHDIFF) && s->reflectance != 0) {
 			RGB_float diff = {0,0,0};
-			std::default_random_engine generator;
 			std::uniform_int_distribution<int> distribution(-10,10);
-			for (int i = 0; i < STOCH_RAYS; ++i) {
+			RayCone wide = cone;
+			wide.spread += STOCH_SPREAD;
+			for (int i = 0; i < settings.stoch_rays; ++i) {
 				h = vec_reflect(ray, norm);
-				h = RotateX(distribution(generator)) *
-					RotateY(distribution(generator)) *
-					RotateZ(distribution(generator)) * h;
-				diff += recursive_ray_trace(end.pos, h,  num+1);
+				h = RotateX(distribution(rng)) *
+					RotateY(distribution(rng)) *
+					RotateZ(distribution(rng)) * h;
+				diff += recursive_ray_trace<F>(job, end.pos, h, num + 1, wide, false, objects);
 			}
-			diff /= 6;
+			// weighted like the original five rays over six
+			diff /= settings.stoch_rays * (STOCH_RAYS + 1.0f) / STOCH_RAYS;
 			color += (diff*s->reflectance);
+			if (g != nullptr) {
+				g->noise = diff*s->reflectance;
+			}
 		}
 
-		if (refract_on) {
+		if ((F & TRACE_REFRACT) && refractWeight != 0) {
 			if (inside) {
 				h = vec_refract(ray, norm, 1.5, 1);
 			} else {
 				h = vec_refract(ray, norm, 1, 1.5);
 			}
-			ract = recursive_ray_trace(end.pos, h, num + 1, !inside);
-		}
-		float reflectWeight = s->reflectance;
-		float refractWeight = 0;
-		if (refract_on && s->transparency > 0) {
-			refractWeight = s->transparency;
-			reflectWeight = (1-refractWeight)*s->reflectance;
+			// Past the critical angle the direction is NaN, and a NaN ray
+			// hits nothing but still walks every mesh BVH it is in
+			if (std::isnan(h.x)) {
+				ract = job.scene->background;
+			} else {
+				ract = recursive_ray_trace<F>(job, end.pos, h, num + 1, cone, !inside, objects);
+			}
 		}
 		color += (ref * reflectWeight + ract * refractWeight);
 	}
 	return color;
 }
 
-void rayThread(int i, int j, Point cur_pixel_pos, Vector ray, float x_grid_size, float y_grid_size) {
+/************************************************************************
+ * This is the recursive ray tracer - you need to implement this!
+ * You should decide what arguments to use.
+ ************************************************************************/
+template <int F>
+RGB_float recursive_ray_trace(const RenderJob &job, Point &pos, Vector &ray, int num,
+		const RayCone &cone, bool inside, const std::vector<Object *> &objects, GSample *g) {
+	IntersectionInfo end;
+	end.cone = cone;
+	if (F & TRACE_COSTS) {
+		ray_counters.rays++;
+	}
+	const Object *s = getClosestObject<F>(pos, ray, end, objects, job.settings.cutoff);
+	if (s == nullptr) {
+		if (g != nullptr) {
+			g->object = nullptr;
+		}
+		return job.scene->background;
+	}
+	return shade<F>(job, s, end, ray, num, inside, g);
+}
+
+// Side of the block each pixel was last filled from, 1 once it is traced
+uint8_t pixel_block[WIN_HEIGHT][WIN_WIDTH];
+
+//
+// Sets pixel (i, j), and in frame the rest of the size by size block
+// below and right of it that hasn't been filled from a smaller block yet
+//
+void set_pixel(const RenderJob &job, int i, int j, const RGB_float &color, int size = 1) {
+	if (job.fb != nullptr) {
+		float *p = job.fb->pixel(i, j);
+		p[0] = color.r;
+		p[1] = color.g;
+		p[2] = color.b;
+		return;
+	}
+	int y1 = std::min(i + size, win_height);
+	int x1 = std::min(j + size, win_width);
+	frame_mutex.lock();
+	for (int y = i; y < y1; ++y) {
+		for (int x = j; x < x1; ++x) {
+			if ((y == i && x == j) || pixel_block[y][x] > size) {
+				frame[y][x][0] = color.r;
+				frame[y][x][1] = color.g;
+				frame[y][x][2] = color.b;
+				pixel_block[y][x] = (y == i && x == j) ? 1 : size;
+			}
+		}
+	}
+	frame_mutex.unlock();
+}
+
+template <int F>
+void rayThread(const RenderJob &job, int i, int j, Point cur_pixel_pos, Vector ray,
+		float x_grid_size, float y_grid_size, const std::vector<Object *> &objects, int size) {
+	const Camera &camera = job.camera;
+	const RGB_float &background = job.scene->background;
+	const bool antialias = F & TRACE_ANTIALIAS;
 	RGB_float ret_color;
 	RGB_float colors[5];
-	colors[0] = recursive_ray_trace(cur_pixel_pos, ray, 1);
+	GSample *g[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
+	if (job.gbuffer) {
+		for (int k = 0; k < 5; ++k) {
+			g[k] = &gbuffer[(i * job.width + j) * 5 + k];
+			g[k]->shadow.valid = false;
+		}
+	}
+	// +d needs the first hits even without +g
+	GSample local[5];
+	if (job.denoise && !job.gbuffer) {
+		for (int k = 0; k < 5; ++k) {
+			g[k] = &local[k];
+			g[k]->shadow.valid = false;
+		}
+	}
+	for (int k = 0; k < 5 && g[k] != nullptr; ++k) {
+		g[k]->noise = {0,0,0};
+	}
+
+	CostProbe probe;
+	if (F & TRACE_COSTS) {
+		probe = start_cost();
+	}
+
+	// the cone of the rays is one pixel wide at the image plane
+	RayCone cone = {x_grid_size, x_grid_size / length(get_vec(camera.eye, cur_pixel_pos)), nullptr, 0};
+
+	begin_sample(job, i, j, 0);
+	if (job.vis) {
+		// the first hit was found by rasterize_scene
+		const VisSample &vis = vis_buffer[i][j];
+		if (vis.object == -1) {
+			if (g[0] != nullptr) {
+				g[0]->object = nullptr;
+			}
+			colors[0] = background;
+		} else {
+			IntersectionInfo end;
+			end.pos = get_point(cur_pixel_pos, ray * vis.depth);
+			end.vertex = vis.face;
+			// the raster always uses the full meshes
+			end.cone = {cone.width + cone.spread * vis.depth, cone.spread, nullptr, 0};
+			colors[0] = shade<F>(job, job.scene->objects[vis.object], end, ray, 1, false, g[0]);
+		}
+	} else {
+		colors[0] = recursive_ray_trace<F>(job, cur_pixel_pos, ray, 1, cone, false, objects, g[0]);
+	}
+	// the guides for +d come from the first hit of the centre sample
+	if (job.denoise) {
+		const std::vector<Object *> &all = job.scene->objects;
+		const Object *o = g[0]->object;
+		if (o == nullptr) {
+			set_aov(i, j, -1, -ray, 0);
+		} else {
+			set_aov(i, j, std::find(all.begin(), all.end(), o) - all.begin(),
+				o->getNormal(g[0]->hit), length(get_vec(cur_pixel_pos, g[0]->hit.pos)));
+		}
+	}
 
 
-	if (antialias_on) {
-		cur_pixel_pos.x += x_grid_size / 2;
-		cur_pixel_pos.y += y_grid_size / 2;
-		colors[1] = recursive_ray_trace(cur_pixel_pos, ray, 1);
+	if (antialias) {
+		Vector dx = camera.right * x_grid_size;
+		Vector dy = camera.up * y_grid_size;
+		cur_pixel_pos = get_point(cur_pixel_pos, dx * 0.5f + dy * 0.5f);
+		begin_sample(job, i, j, 1);
+		colors[1] = recursive_ray_trace<F>(job, cur_pixel_pos, ray, 1, cone, false, objects, g[1]);
 
-		cur_pixel_pos.y -= y_grid_size;
-		colors[2] = recursive_ray_trace(cur_pixel_pos, ray, 1);
+		cur_pixel_pos = get_point(cur_pixel_pos, -dy);
+		begin_sample(job, i, j, 2);
+		colors[2] = recursive_ray_trace<F>(job, cur_pixel_pos, ray, 1, cone, false, objects, g[2]);
 
-		cur_pixel_pos.x -= x_grid_size;
-		colors[3] = recursive_ray_trace(cur_pixel_pos, ray, 1);
+		cur_pixel_pos = get_point(cur_pixel_pos, -dx);
+		begin_sample(job, i, j, 3);
+		colors[3] = recursive_ray_trace<F>(job, cur_pixel_pos, ray, 1, cone, false, objects, g[3]);
 
-		cur_pixel_pos.y += y_grid_size;
-		colors[4] = recursive_ray_trace(cur_pixel_pos, ray, 1);
+		cur_pixel_pos = get_point(cur_pixel_pos, dy);
+		begin_sample(job, i, j, 4);
+		colors[4] = recursive_ray_trace<F>(job, cur_pixel_pos, ray, 1, cone, false, objects, g[4]);
 
 		ret_color = {0,0,0};
 		for (int i = 0; i < 5; ++i) {
@@ -159,63 +611,300 @@ void rayThread(int i, int j, Point cur_pixel_pos, Vector ray, float x_grid_size,
 	} else {
 		ret_color = colors[0];
 	}
+	if (F & TRACE_COSTS) {
+		record_cost(i, j, probe);
+	}
 
+	if (job.denoise) {
+		int samples = antialias ? 5 : 1;
+		RGB_float noise = {0,0,0};
+		for (int k = 0; k < samples; ++k) {
+			noise += g[k]->noise;
+		}
+		noise /= samples;
+		set_noise(i, j, noise);
+	}
+	set_pixel(job, i, j, ret_color, size);
+}
 
-	frame_mutex.lock();
-	frame[i][j][0] = ret_color.r;
-	frame[i][j][1] = ret_color.g;
-	frame[i][j][2] = ret_color.b;
-	frame_mutex.unlock();
+// how long each tile of frame took in the last frame that finished
+std::vector<float> tile_times;
+
+//
+// return the position on the image plane of the centre of pixel (i, j)
+//
+Point pixel_pos(float i, float j) {
+	return camera_pixel(camera, win_width, win_height, i, j);
 }
 
-struct RayData {
-	int i;
-	int j;
-	Point cur_pixel_pos;
-	Vector ray;
-	float x_grid_size;
-	float y_grid_size;
-};
+static Point job_pixel(const RenderJob &job, float i, float j) {
+	return camera_pixel(job.camera, job.width, job.height, i, j);
+}
 
-std::queue<RayData> queue;
-std::mutex queue_mutex;
-std::condition_variable queue_condition;
+/*********************************************************************
+ * Culls the scene against the frustum from the eye through the tile.
+ * The frustum goes through the pixel edges so that the antialiasing
+ * rays, which are offset by half a pixel, are covered as well.
+ *********************************************************************/
+void cull_tile(const RenderJob &job, Tile &t) {
+	const Point &eye = job.camera.eye;
+	Point corners[4] = {
+		job_pixel(job, t.y0 - 0.5, t.x0 - 0.5),
+		job_pixel(job, t.y0 - 0.5, t.x1 - 0.5),
+		job_pixel(job, t.y1 - 0.5, t.x1 - 0.5),
+		job_pixel(job, t.y1 - 0.5, t.x0 - 0.5),
+	};
+	Vector centre = get_vec(eye, job_pixel(job, (t.y0 + t.y1) * 0.5 - 0.5, (t.x0 + t.x1) * 0.5 - 0.5));
 
-void workThread() {
-	{
-		std::unique_lock<std::mutex> lock(queue_mutex);
-		queue_condition.wait(lock);
+	Vector normals[4];
+	for (int k = 0; k < 4; ++k) {
+		Vector a = get_vec(eye, corners[k]);
+		Vector b = get_vec(eye, corners[(k + 1) % 4]);
+		normals[k] = cross(a, b);
+		if (dot(normals[k], centre) < 0) {
+			normals[k] *= -1;
+		}
 	}
-	while (1) {
-		queue_mutex.lock();
-		if (queue.size() == 0) {
-			queue_mutex.unlock();
-			break;
+
+	t.objects.clear();
+	for (auto *o : job.scene->objects) {
+		Vector bbmin, bbmax;
+		o->getBounds(bbmin, bbmax);
+		bool inside = true;
+		for (int k = 0; k < 4 && inside; ++k) {
+			// the corner of the box furthest along the plane normal
+			Vector n = normals[k];
+			Point p;
+			p.x = n.x > 0 ? bbmax.x : bbmin.x;
+			p.y = n.y > 0 ? bbmax.y : bbmin.y;
+			p.z = n.z > 0 ? bbmax.z : bbmin.z;
+			inside = dot(n, get_vec(eye, p)) >= -0.0001;
 		}
+		if (inside) {
+			t.objects.push_back(o);
+		}
+	}
+}
+
+void build_tiles(RenderJob &job) {
+	job.tiles.clear();
+	for (int y = 0; y < job.height; y += TILE_SIZE) {
+		for (int x = 0; x < job.width; x += TILE_SIZE) {
+			Tile t;
+			t.x0 = x;
+			t.y0 = y;
+			t.x1 = std::min(x + TILE_SIZE, job.width);
+			t.y1 = std::min(y + TILE_SIZE, job.height);
+			t.done = false;
+			cull_tile(job, t);
+			job.tiles.push_back(t);
+		}
+	}
+}
+
+//
+// Traces the pixels of the tile on a grid of step pixels, filling the
+// step by step block of each. Pixels on the grid of the pass before
+// (2 * step) are skipped, unless this is the first pass.
+//
+template <int F>
+void renderTile(const RenderJob &job, const Tile &t, int step, bool first) {
+	float x_grid_size = job.camera.width / float(job.width);
+	float y_grid_size = job.camera.height / float(job.height);
+	for (int i = t.y0; i < t.y1; ++i) {
+		if (i % step != 0) {
+			continue;
+		}
+		for (int j = t.x0; j < t.x1; ++j) {
+			if (j % step != 0 || (!first && i % (step * 2) == 0 && j % (step * 2) == 0)) {
+				continue;
+			}
+			// ray is cast through center of pixel
+			Point cur_pixel_pos = job_pixel(job, i, j);
+			Vector ray = get_vec(job.camera.eye, cur_pixel_pos);
+			ray = normalize(ray);
+
+			rayThread<F>(job, i, j, cur_pixel_pos, ray, x_grid_size, y_grid_size, t.objects, step);
+		}
+	}
+}
+
+//
+// Traces a few primary rays spread over the tile and returns their
+// average time times the pixels of the tile
+//
+template <int F>
+float sample_tile_cost(const RenderJob &job, const Tile &t) {
+	float x_grid_size = job.camera.width / float(job.width);
+	const Point &eye = job.camera.eye;
+	auto start = std::chrono::steady_clock::now();
+	for (int k = 0; k < SCHEDULE_SAMPLES; ++k) {
+		// spread the samples over the tile like the 2D Halton points
+		float u = (k + 0.5f) / SCHEDULE_SAMPLES;
+		float v = 0;
+		for (int b = k + 1, f = 2; b > 0; b /= 2, f *= 2) {
+			v += float(b % 2) / f;
+		}
+		int i = t.y0 + (int)(u * (t.y1 - t.y0));
+		int j = t.x0 + (int)(v * (t.x1 - t.x0));
+		Point pos = job_pixel(job, i, j);
+		Vector ray = normalize(get_vec(eye, pos));
+		RayCone cone = {x_grid_size, x_grid_size / length(get_vec(eye, pos)), nullptr, 0};
+		begin_sample(job, i, j, 0);
+		recursive_ray_trace<F>(job, pos, ray, 1, cone, false, t.objects);
+	}
+	auto end = std::chrono::steady_clock::now();
+	float pixels = (t.x1 - t.x0) * (t.y1 - t.y0);
+	return std::chrono::duration<float>(end - start).count() / SCHEDULE_SAMPLES * pixels;
+}
+
+/*********************************************************************
+ * Estimates what each tile will cost, from the times of the last frame
+ * when there is one with the same tiles, or else from a pre-pass that
+ * traces SCHEDULE_SAMPLES pixels of each tile
+ *********************************************************************/
+void estimate_tile_costs(RenderJob &job, const std::vector<float> *last_times) {
+	std::vector<Tile> &tiles = job.tiles;
+	if (last_times != nullptr && last_times->size() == tiles.size()) {
+		for (unsigned int k = 0; k < tiles.size(); ++k) {
+			tiles[k].cost = (*last_times)[k];
+		}
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	render_pool().parallel_for(tiles.size(), [&job](int k) {
+		const Tile &t = job.tiles[k];
+		job.tiles[k].cost = t.done ? 0 : job.kernel.tile_cost(job, t);
+	});
+	auto end = std::chrono::steady_clock::now();
+	printf("Tile cost pre-pass: %.1f ms\n",
+		std::chrono::duration<float, std::milli>(end - start).count());
+}
+
+void queue_job(std::function<void()> job) {
+	render_pool().queue_job(std::move(job));
+}
+
+void wait_jobs(std::atomic<int> &pending) {
+	render_pool().wait_jobs(pending);
+}
+
+template <int F>
+void reshade_rows(const RenderJob &job, int y0, int y1);
 
-		RayData d = queue.front();
-		queue.pop();
-		queue_mutex.unlock();
-		rayThread(d.i, d.j, d.cur_pixel_pos, d.ray, d.x_grid_size, d.y_grid_size);
+// Fills table[0..F] with the kernels of every feature set up to F
+template <int F>
+struct KernelTable {
+	static void fill(Kernel *table) {
+		table[F] = {renderTile<F>, sample_tile_cost<F>, reshade_rows<F>};
+		KernelTable<F - 1>::fill(table);
 	}
+};
+
+template <>
+struct KernelTable<-1> {
+	static void fill(Kernel *) {}
+};
+
+//
+// The kernel compiled for the features that are on in settings, and for
+// counting the cost of every pixel with costs
+//
+static Kernel select_kernel(const RenderSettings &settings, bool costs) {
+	static Kernel table[TRACE_ALL + 1];
+	static std::once_flag filled;
+	std::call_once(filled, [] {
+		KernelTable<TRACE_ALL>::fill(table);
+	});
+	int features = 0;
+	features |= settings.shadow_on ? TRACE_SHADOW : 0;
+	features |= settings.reflect_on ? TRACE_REFLECT : 0;
+	features |= settings.refract_on ? TRACE_REFRACT : 0;
+	features |= settings.stochdiff_on ? TRACE_STOCHDIFF : 0;
+	features |= settings.antialias_on ? TRACE_ANTIALIAS : 0;
+	features |= settings.fast_math_on ? TRACE_FASTMATH : 0;
+	features |= costs ? TRACE_COSTS : 0;
+	return table[features];
 }
 
-std::vector<std::thread> threads;
+/*********************************************************************
+ * Submits the tiles of the job to the pool as one frame, once per pass
+ * from blocks of first pixels down to single pixels, traced by the
+ * kernel of its settings. With schedule_on the tiles are queued most
+ * expensive first, so no thread is left with a slow tile at the end
+ * while the others wait. Tiles that are done already are left out, and
+ * each tile goes to the checkpoint once all of its passes are traced. finish
+ * runs once the last tile is done, with the times of the tiles in
+ * job.times.
+ *********************************************************************/
+static std::shared_ptr<RenderFrame> submit_job(std::shared_ptr<RenderJob> job, int first,
+		const std::vector<float> *last_times, std::function<void()> finish) {
+	job->kernel = select_kernel(job->settings, job->heatmap);
+	const std::vector<Tile> &tiles = job->tiles;
+	std::vector<int> order(tiles.size());
+	for (unsigned int k = 0; k < order.size(); ++k) {
+		order[k] = k;
+	}
+	if (job->settings.schedule_on) {
+		estimate_tile_costs(*job, last_times);
+		std::stable_sort(order.begin(), order.end(), [&tiles](int a, int b) {
+			return tiles[a].cost > tiles[b].cost;
+		});
+	}
 
-void queueRay(int i, int j, const Point &cur_pixel_pos, const Vector &ray, float x_grid_size, float y_grid_size) {
-	RayData d;
-	d.i = i;
-	d.j = j;
-	d.cur_pixel_pos = cur_pixel_pos;
-	d.ray = ray;
-	d.x_grid_size = x_grid_size;
-	d.y_grid_size = y_grid_size;
+	std::vector<std::function<void()>> work;
+	int passes = 0;
+	for (int step = first; step >= 1; step /= 2) {
+		passes++;
+	}
+	int count = tiles.size();
+	job->times.assign(count * passes, 0.0f);
+	job->passes_left.reset(new std::atomic<int>[count]);
+	for (int k = 0; k < count; ++k) {
+		job->passes_left[k] = passes;
+	}
+	for (int step = first, pass = 0; step >= 1; step /= 2, ++pass) {
+		for (int k : order) {
+			if (tiles[k].done) {
+				continue;
+			}
+			float *time = &job->times[pass * count + k];
+			work.push_back([job, k, step, first, time] {
+				auto start = std::chrono::steady_clock::now();
+				job->kernel.tile(*job, job->tiles[k], step, step == first);
+				auto end = std::chrono::steady_clock::now();
+				*time = std::chrono::duration<float>(end - start).count();
+				if (--job->passes_left[k] == 0 && job->checkpoint) {
+					job->checkpoint->tileDone(k);
+				}
+			});
+		}
+	}
+	return render_pool().submit(std::move(work), finish);
+}
 
-	queue_mutex.lock();
-	queue.push(d);
-	queue_mutex.unlock();
+std::shared_future<void> render(const Scene &scene, const Camera &camera,
+		const RenderSettings &settings, Framebuffer &fb) {
+	auto job = std::make_shared<RenderJob>();
+	job->scene = &scene;
+	job->camera = camera;
+	job->settings = settings;
+	job->width = fb.width;
+	job->height = fb.height;
+	job->fb = &fb;
+	job->gbuffer = false;
+	job->denoise = false;
+	job->vis = false;
+	job->heatmap = false;
+	build_tiles(*job);
+	return submit_job(job, 1, nullptr, nullptr)->done();
 }
 
+// The scene of the globals, which frame is rendered from
+Scene frame_scene;
+std::shared_ptr<RenderJob> current_job;
+std::shared_ptr<RenderFrame> current_frame;
+
 /*********************************************************************
  * This function traverses all the pixels and cast rays. It calls the
  * recursive ray tracer and assign return color to frame
@@ -223,47 +912,189 @@ void queueRay(int i, int j, const Point &cur_pixel_pos, const Vector &ray, float
  * You should not need to change it except for the call to the recursive
  * ray tracer. Feel free to change other parts of the function however,
  * if you must.
+ *
+ * The scene, camera and flags are taken from the globals into a job
+ * traced like any render(). The render threads first build the
+ * acceleration structures, unless lazy_build_on leaves that to the
+ * first ray that reaches each model. Then the image is split into tiles
+ * of TILE_SIZE pixels which are culled against the scene and submitted
+ * to the pool as one frame. The returned future is ready once every
+ * tile is done. A frame still in flight is waited for first, since the
+ * tiles belong to it.
+ *
+ * With progressive_on every tile is queued once per pass. The first
+ * pass traces one pixel in each PREVIEW_BLOCK square block and fills
+ * the block with it, and each pass after halves the block and only
+ * traces the pixels that are new, so the whole image shows up early.
+ *
+ * With denoise_on the frame is filtered once the last tile is done, and
+ * with heatmap_on the cost of the tiles is printed.
+ *
+ * With checkpoint the finished tiles are saved to output_name.ckpt as
+ * they come in, except with +g or +d, and with resume_on the tiles saved
+ * there by a render of the same flags are loaded instead of traced. The
+ * file is removed once the frame is complete.
  *********************************************************************/
-void ray_trace() {
-	int i, j;
-	float x_grid_size = image_width / float(win_width);
-	float y_grid_size = image_height / float(win_height);
-	float x_start = -0.5 * image_width;
-	float y_start = -0.5 * image_height;
-	Point cur_pixel_pos;
-	Vector ray;
-
-	// ray is cast through center of pixel
-	cur_pixel_pos.x = x_start + 0.5 * x_grid_size;
-	cur_pixel_pos.y = y_start + 0.5 * y_grid_size;
-	cur_pixel_pos.z = image_plane;
-
-	for (unsigned int i = 0; i < std::thread::hardware_concurrency(); ++i) {
-		std::thread t(workThread);
-		threads.push_back(std::move(t));
+std::shared_future<void> ray_trace(bool checkpoint) {
+	if (current_frame) {
+		current_frame->done().wait();
 	}
+	global_scene(frame_scene);
+	prepare_scene(frame_scene, !lazy_build_on);
 
-	for (i=0; i<win_height; i++) {
-		for (j=0; j<win_width; j++) {
-			ray = get_vec(eye_pos, cur_pixel_pos);
-			ray = normalize(ray);
+	auto job = std::make_shared<RenderJob>();
+	job->scene = &frame_scene;
+	job->camera = camera;
+	job->settings = global_settings();
+	job->width = win_width;
+	job->height = win_height;
+	job->fb = nullptr;
+	job->gbuffer = gbuffer_on;
+	job->denoise = denoise_on;
+	job->vis = vis_on;
+	job->heatmap = heatmap_on;
+	build_tiles(*job);
+	if (vis_on) {
+		rasterize_scene();
+	}
+	if (gbuffer_on) {
+		gbuffer.resize(win_width * win_height * 5);
+		gbuffer_lights.clear();
+		for (const Light &l : lights) {
+			gbuffer_lights.push_back(l.pos);
+		}
+		gbuffer_shadow_on = shadow_on;
+	}
 
-			queueRay(i, j, cur_pixel_pos, ray, x_grid_size, y_grid_size);
+	// +g and +d need every pixel traced, and +d rewrites frame in finish
+	// while the writer could still be reading it, so neither checkpoints
+	if (checkpoint && (gbuffer_on || denoise_on)) {
+		if (resume_on) {
+			printf("+u can't be used with +g or +d, rendering all of it\n");
+		}
+	} else if (checkpoint) {
+		job->checkpoint.reset(new Checkpoint(std::string(output_name) + ".ckpt", render_key,
+			&frame[0][0][0], win_width, win_height, WIN_WIDTH));
+	}
+	if (job->checkpoint && resume_on && job->checkpoint->resume() >= 0) {
+		int resumed = 0;
+		for (unsigned int k = 0; k < job->tiles.size(); ++k) {
+			job->tiles[k].done = job->checkpoint->done(k);
+			resumed += job->tiles[k].done;
+		}
+		printf("Resumed %d of %d tiles\n", resumed, (int)job->tiles.size());
+	}
 
-			cur_pixel_pos.x += x_grid_size;
+	memset(pixel_block, 0xff, sizeof(pixel_block));
+	if (heatmap_on) {
+		reset_costs();
+	}
+	std::function<void()> finish = [job] {
+		int count = job->tiles.size();
+		tile_times.assign(count, 0);
+		for (unsigned int k = 0; k < job->times.size(); ++k) {
+			tile_times[k % count] += job->times[k];
+		}
+		if (job->denoise) {
+			denoise_frame();
+		}
+		if (job->heatmap) {
+			report_costs();
+		}
+		if (job->checkpoint) {
+			job->checkpoint->finish();
 		}
+	};
+	current_job = job;
+	current_frame = submit_job(job, progressive_on ? PREVIEW_BLOCK : 1, &tile_times, finish);
+	return current_frame->done();
+}
 
-		cur_pixel_pos.y += y_grid_size;
-		cur_pixel_pos.x = x_start;
+void cancel_frame() {
+	if (current_frame) {
+		current_frame->cancel();
 	}
-	queue_condition.notify_all();
 }
 
 void cleanup_threads() {
-	queue_mutex.lock();
-	queue = std::queue<RayData>();
-	queue_mutex.unlock();
-	for (auto &t : threads) {
-		t.join();
+	cancel_frame();
+	if (current_frame) {
+		current_frame->done().wait();
+	}
+	shutdown_render_pool();
+}
+
+bool render_done() {
+	return current_frame && !current_frame->cancelled() &&
+		current_frame->done().wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+template <int F>
+void reshade_rows(const RenderJob &job, int y0, int y1) {
+	int samples = (F & TRACE_ANTIALIAS) ? 5 : 1;
+	for (int i = y0; i < y1; ++i) {
+		for (int j = 0; j < job.width; ++j) {
+			RGB_float color = {0,0,0};
+			RGB_float noise = {0,0,0};
+			for (int k = 0; k < samples; ++k) {
+				GSample &g = gbuffer[(i * job.width + j) * 5 + k];
+				begin_sample(job, i, j, k);
+				if (g.object == nullptr) {
+					color += job.scene->background;
+				} else {
+					IntersectionInfo hit = g.hit;
+					Vector ray = g.ray;
+					color += shade<F>(job, g.object, hit, ray, 1, false, &g);
+				}
+				noise += g.noise;
+			}
+			color /= samples;
+			if (job.denoise) {
+				noise /= samples;
+				set_noise(i, j, noise);
+			}
+			set_pixel(job, i, j, color);
+		}
+	}
+}
+
+/*********************************************************************
+ * Shades the frame again from the cached first hits, after lighting or
+ * material parameters have changed. The shadow rays of the first hits
+ * are only cast again if a light moved.
+ *********************************************************************/
+void reshade() {
+	auto start = std::chrono::steady_clock::now();
+	global_scene(frame_scene);
+	prepare_scene(frame_scene, false);
+
+	bool moved = lights.size() != gbuffer_lights.size() || shadow_on != gbuffer_shadow_on;
+	for (unsigned int k = 0; k < lights.size() && !moved; ++k) {
+		moved = lights[k].pos.x != gbuffer_lights[k].x ||
+			lights[k].pos.y != gbuffer_lights[k].y ||
+			lights[k].pos.z != gbuffer_lights[k].z;
+	}
+	if (moved) {
+		for (GSample &g : gbuffer) {
+			g.shadow.valid = false;
+		}
+		gbuffer_lights.clear();
+		for (const Light &l : lights) {
+			gbuffer_lights.push_back(l.pos);
+		}
+		gbuffer_shadow_on = shadow_on;
 	}
+
+	const RenderJob &job = *current_job;
+	int count = render_pool().size();
+	render_pool().parallel_for(count, [&job, count](int k) {
+		job.kernel.reshade_rows(job, job.height * k / count, job.height * (k + 1) / count);
+	});
+	if (denoise_on) {
+		denoise_frame();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	printf("Re-shaded in %d ms\n",
+		(int)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
 }
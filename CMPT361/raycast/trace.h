@@ -1,3 +1,30 @@
 #pragma once
 
-void ray_trace();
+#include <atomic>
+#include <functional>
+#include <future>
+#include "vector.h"
+
+// hits further than this are ignored, see RenderSettings
+extern int cuttoff;
+
+// Starts rendering the scene, camera and flags of the globals into frame
+// on the render pool. The future is ready once every tile is in it. With
+// checkpoint the tiles are saved as they finish, so +u can resume them.
+std::shared_future<void> ray_trace(bool checkpoint = false);
+// Skips the tiles of the current frame that haven't started
+void cancel_frame();
+// Cancels the current frame and stops the render threads
+void cleanup_threads();
+// true once every tile of the last ray_trace has been rendered
+bool render_done();
+// needs +g, see trace.cpp
+void reshade();
+// The centre of pixel (i, j) of the frame, seen by camera
+Point pixel_pos(float i, float j);
+
+// Adds a job for the render threads
+void queue_job(std::function<void()> job);
+// Runs queued jobs on this thread until pending drops to zero, which
+// only jobs may count down
+void wait_jobs(std::atomic<int> &pending);
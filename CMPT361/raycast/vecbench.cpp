@@ -0,0 +1,167 @@
+/**********************************************************************
+ * Times the vec4 and mat4 operators of include/vec.h and include/mat.h
+ * against the plain scalar code they replaced, and checks that both
+ * give the same results bit for bit.
+ *
+ *   ./vecbench [rounds]
+ *
+ * Exits with 1 if any result differs. Build with -DANGEL_NO_SIMD to time
+ * the fallback without SSE or NEON.
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <random>
+#include <chrono>
+
+#include "include/mat.h"
+
+// values per operation, small enough to stay in the cache
+#define BENCH_SIZE 1024
+// times each operation is timed, the fastest is reported
+#define BENCH_REPEATS 7
+
+//
+// The scalar operators as they were
+//
+static float ref_dot(const vec4 &u, const vec4 &v) {
+	return u.x*v.x + u.y*v.y + u.z*v.z + u.w*v.w;
+}
+
+static vec4 ref_normalize(const vec4 &v) {
+	float r = 1.0f / std::sqrt(ref_dot(v, v));
+	return vec4(r*v.x, r*v.y, r*v.z, r*v.w);
+}
+
+static vec3 ref_cross(const vec4 &a, const vec4 &b) {
+	return vec3(a.y * b.z - a.z * b.y,
+		a.z * b.x - a.x * b.z,
+		a.x * b.y - a.y * b.x);
+}
+
+static mat4 ref_mul(const mat4 &l, const mat4 &m) {
+	mat4 a(0.0);
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			for (int k = 0; k < 4; ++k) {
+				a[i][j] += l[i][k] * m[k][j];
+			}
+		}
+	}
+	return a;
+}
+
+static vec4 ref_mul(const mat4 &m, const vec4 &v) {
+	return vec4(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z + m[0][3]*v.w,
+		m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z + m[1][3]*v.w,
+		m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z + m[2][3]*v.w,
+		m[3][0]*v.x + m[3][1]*v.y + m[3][2]*v.z + m[3][3]*v.w);
+}
+
+static int failures = 0;
+
+static void check(const char *name, const float *a, const float *b, int n) {
+	if (memcmp(a, b, n * sizeof(float)) != 0) {
+		printf("%s: results differ\n", name);
+		failures++;
+	}
+}
+
+//
+// Runs op over every input for the given rounds and returns the time of
+// one call in ns, the best of BENCH_REPEATS tries
+//
+template <typename Op>
+static double time_op(int rounds, Op op) {
+	double best = 0;
+	for (int t = 0; t < BENCH_REPEATS; ++t) {
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; ++r) {
+			for (int i = 0; i < BENCH_SIZE; ++i) {
+				op(i);
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(end - start).count() / rounds / BENCH_SIZE;
+		best = t == 0 || ns < best ? ns : best;
+	}
+	return best;
+}
+
+static void report(const char *name, double ref, double simd) {
+	printf("  %-16s %8.2f %8.2f %6.2fx\n", name, ref, simd, ref / simd);
+}
+
+int main(int argc, char **argv) {
+	int rounds = argc > 1 ? atoi(argv[1]) : 500;
+
+	std::default_random_engine rng(1);
+	std::uniform_real_distribution<float> dist(-2, 2);
+	std::vector<vec4> u(BENCH_SIZE), v(BENCH_SIZE);
+	std::vector<mat4> m(BENCH_SIZE), n(BENCH_SIZE);
+	for (int i = 0; i < BENCH_SIZE; ++i) {
+		u[i] = vec4(dist(rng), dist(rng), dist(rng), dist(rng));
+		v[i] = vec4(dist(rng), dist(rng), dist(rng), dist(rng));
+		for (int r = 0; r < 4; ++r) {
+			for (int c = 0; c < 4; ++c) {
+				m[i][r][c] = dist(rng);
+				n[i][r][c] = dist(rng);
+			}
+		}
+	}
+
+	std::vector<float> fa(BENCH_SIZE), fb(BENCH_SIZE);
+	std::vector<vec3> ca(BENCH_SIZE), cb(BENCH_SIZE);
+	std::vector<vec4> va(BENCH_SIZE), vb(BENCH_SIZE);
+	std::vector<mat4> ma(BENCH_SIZE), mb(BENCH_SIZE);
+
+#if defined(ANGEL_SSE)
+	printf("vec4 and mat4 with SSE, ns per call:\n");
+#elif defined(ANGEL_NEON)
+	printf("vec4 and mat4 with NEON, ns per call:\n");
+#else
+	printf("vec4 and mat4 without SIMD, ns per call:\n");
+#endif
+	printf("  %-16s %8s %8s %7s\n", "", "scalar", "vec.h", "");
+
+	double ref, simd;
+	ref = time_op(rounds, [&](int i) { fa[i] = ref_dot(u[i], v[i]); });
+	simd = time_op(rounds, [&](int i) { fb[i] = dot(u[i], v[i]); });
+	check("dot", &fa[0], &fb[0], BENCH_SIZE);
+	report("dot", ref, simd);
+
+	ref = time_op(rounds, [&](int i) { ca[i] = ref_cross(u[i], v[i]); });
+	simd = time_op(rounds, [&](int i) { cb[i] = cross(u[i], v[i]); });
+	check("cross", &ca[0].x, &cb[0].x, BENCH_SIZE * 3);
+	report("cross", ref, simd);
+
+	ref = time_op(rounds, [&](int i) { va[i] = ref_normalize(u[i]); });
+	simd = time_op(rounds, [&](int i) { vb[i] = normalize(u[i]); });
+	check("normalize", &va[0].x, &vb[0].x, BENCH_SIZE * 4);
+	report("normalize", ref, simd);
+
+	ref = time_op(rounds, [&](int i) { va[i] = ref_mul(m[i], u[i]); });
+	simd = time_op(rounds, [&](int i) { vb[i] = m[i] * u[i]; });
+	check("mat4 * vec4", &va[0].x, &vb[0].x, BENCH_SIZE * 4);
+	report("mat4 * vec4", ref, simd);
+
+	ref = time_op(rounds, [&](int i) { ma[i] = ref_mul(m[i], n[i]); });
+	simd = time_op(rounds, [&](int i) { mb[i] = m[i] * n[i]; });
+	check("mat4 * mat4", &ma[0][0].x, &mb[0][0].x, BENCH_SIZE * 16);
+	report("mat4 * mat4", ref, simd);
+
+	// the rotation of the stochastic diffuse rays in trace.cpp
+	ref = time_op(rounds, [&](int i) {
+		va[i] = ref_mul(ref_mul(ref_mul(RotateX(i), RotateY(i)), RotateZ(i)), u[i]);
+	});
+	simd = time_op(rounds, [&](int i) { vb[i] = RotateX(i) * RotateY(i) * RotateZ(i) * u[i]; });
+	check("rotate", &va[0].x, &vb[0].x, BENCH_SIZE * 4);
+	report("rotate", ref, simd);
+
+	if (failures > 0) {
+		return 1;
+	}
+	printf("All results match\n");
+	return 0;
+}
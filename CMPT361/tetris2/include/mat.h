@@ -34,12 +34,8 @@ class mat2 {
     mat2( GLfloat m00, GLfloat m10, GLfloat m01, GLfloat m11 )
 	{ _m[0] = vec2( m00, m01 ); _m[1] = vec2( m10, m11 ); }
 
-    mat2( const mat2& m ) {
-	if ( *this != m ) {
-	    _m[0] = m._m[0];
-	    _m[1] = m._m[1];
-	} 
-    }
+    mat2( const mat2& m )
+	{ _m[0] = m._m[0];  _m[1] = m._m[1]; }
 
     //
     //  --- Indexing Operator ---
@@ -213,13 +209,7 @@ class mat3 {
 	}
 
     mat3( const mat3& m )
-	{
-	    if ( *this != m ) {
-		_m[0] = m._m[0];
-		_m[1] = m._m[1];
-		_m[2] = m._m[2];
-	    } 
-	}
+	{ _m[0] = m._m[0];  _m[1] = m._m[1];  _m[2] = m._m[2]; }
 
     //
     //  --- Indexing Operator ---
@@ -402,14 +392,7 @@ class mat4 {
 	}
 
     mat4( const mat4& m )
-	{
-	    if ( *this != m ) {
-		_m[0] = m._m[0];
-		_m[1] = m._m[1];
-		_m[2] = m._m[2];
-		_m[3] = m._m[3];
-	    } 
-	}
+	{ _m[0] = m._m[0];  _m[1] = m._m[1];  _m[2] = m._m[2];  _m[3] = m._m[3]; }
 
     //
     //  --- Indexing Operator ---
@@ -447,6 +430,8 @@ class mat4 {
     friend mat4 operator * ( const GLfloat s, const mat4& m )
 	{ return m * s; }
 	
+    // Left scalar: the SIMD version was no faster here, and slower inside
+    // the chains of rotations (see vecbench)
     mat4 operator * ( const mat4& m ) const {
 	mat4  a( 0.0 );
 
@@ -551,19 +536,14 @@ class mat4 {
 
 inline
 mat4 matrixCompMult( const mat4& A, const mat4& B ) {
-    return mat4(
-	A[0][0]*B[0][0], A[0][1]*B[0][1], A[0][2]*B[0][2], A[0][3]*B[0][3],
-	A[1][0]*B[1][0], A[1][1]*B[1][1], A[1][2]*B[1][2], A[1][3]*B[1][3],
-	A[2][0]*B[2][0], A[2][1]*B[2][1], A[2][2]*B[2][2], A[2][3]*B[2][3],
-	A[3][0]*B[3][0], A[3][1]*B[3][1], A[3][2]*B[3][2], A[3][3]*B[3][3] );
+    return mat4( A[0]*B[0], A[1]*B[1], A[2]*B[2], A[3]*B[3] );
 }
 
 inline
 mat4 transpose( const mat4& A ) {
-    return mat4( A[0][0], A[1][0], A[2][0], A[3][0],
-		 A[0][1], A[1][1], A[2][1], A[3][1],
-		 A[0][2], A[1][2], A[2][2], A[3][2],
-		 A[0][3], A[1][3], A[2][3], A[3][3] );
+    simd4 r0 = A[0].simd(), r1 = A[1].simd(), r2 = A[2].simd(), r3 = A[3].simd();
+    simd_transpose( r0, r1, r2, r3 );
+    return mat4( vec4( r0 ), vec4( r1 ), vec4( r2 ), vec4( r3 ) );
 }
 
 //////////////////////////////////////////////////////////////////////////////